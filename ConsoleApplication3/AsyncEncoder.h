@@ -0,0 +1,72 @@
+﻿#pragma once
+
+#include "BoundedQueue.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Асинхронное сохранение изображений: вызывающий поток передаёт задачи кодирования (вместе с буферами)
+// в ограниченную очередь, а несколько потоков кодируют и пишут файлы. Когда очередь заполнена,
+// submit ждёт, поэтому в памяти одновременно находится не больше queue_capacity + threads буферов.
+class AsyncEncoder {
+public:
+    // threads == 0 - по числу аппаратных потоков; queue_capacity == 0 - по два задания на поток
+    explicit AsyncEncoder(unsigned threads = 0, size_t queue_capacity = 0)
+        : queue_(queue_capacity > 0 ? queue_capacity : 2 * resolve_threads(threads)) {
+        threads = resolve_threads(threads);
+        for (unsigned i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~AsyncEncoder() {
+        queue_.close();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    AsyncEncoder(const AsyncEncoder&) = delete;
+    AsyncEncoder& operator=(const AsyncEncoder&) = delete;
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++pending_;
+        }
+        queue_.push(std::move(task));
+    }
+
+    // Ожидание записи всех поставленных изображений
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+    }
+
+private:
+    static unsigned resolve_threads(unsigned threads) {
+        return threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    void worker_loop() {
+        std::function<void()> task;
+        while (queue_.pop(task)) {
+            task();
+            task = nullptr;
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0) {
+                done_.notify_all();
+            }
+        }
+    }
+
+    BoundedQueue<std::function<void()>> queue_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+    size_t pending_ = 0;
+};
@@ -0,0 +1,193 @@
+﻿#pragma once
+
+#include "AsyncEncoder.h"
+#include "BoundedQueue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Входные файлы пакетного режима: изображения каталога (по имени файла) либо пути из файла-списка (по одному в строке)
+inline std::vector<std::string> collect_batch_inputs(const std::string& path) {
+    namespace fs = std::filesystem;
+    static const char* const extensions[] = { ".jpg", ".jpeg", ".png", ".bmp", ".tga", ".gif", ".ppm", ".pgm", ".pnm" };
+
+    std::vector<std::string> inputs;
+    std::error_code error;
+    if (fs::is_directory(path, error)) {
+        for (const auto& entry : fs::directory_iterator(path, error)) {
+            if (!entry.is_regular_file(error)) {
+                continue;
+            }
+            std::string extension = entry.path().extension().string();
+            for (char& c : extension) {
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            }
+            if (std::find(std::begin(extensions), std::end(extensions), extension) != std::end(extensions)) {
+                inputs.push_back(entry.path().string());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+    }
+    else {
+        std::ifstream list(path);
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty()) {
+                inputs.push_back(line);
+            }
+        }
+    }
+    return inputs;
+}
+
+// Имя входного файла без каталога и расширения (для имён выходных файлов)
+inline std::string batch_output_stem(const std::string& input) {
+    return std::filesystem::path(input).stem().string();
+}
+
+// Уникальные имена выходных файлов для всех входов. Обычно это batch_output_stem, но у входов с совпадающим
+// именем (a/img.jpg и b/img.jpg в списке, img.jpg и img.png в каталоге) к имени добавляется номер входа
+// (с 1), иначе они писали бы в один и тот же выход. Имена сравниваются без учёта регистра, как в файловой
+// системе Windows. renamed (если задан) - число переименованных входов.
+inline std::vector<std::string> batch_output_names(const std::vector<std::string>& inputs, size_t* renamed = nullptr) {
+    auto key = [](std::string name) {
+        for (char& c : name) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        return name;
+    };
+
+    std::vector<std::string> names(inputs.size());
+    std::vector<std::string> keys(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        names[i] = batch_output_stem(inputs[i]);
+        keys[i] = key(names[i]);
+    }
+    std::vector<std::string> sorted_keys = keys;
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+    auto count = [&](const std::string& k) {
+        auto range = std::equal_range(sorted_keys.begin(), sorted_keys.end(), k);
+        return static_cast<size_t>(range.second - range.first);
+    };
+
+    // Занятые имена: все неповторяющиеся исходные и уже выданные с номером
+    std::vector<std::string> taken;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (count(keys[i]) == 1) {
+            taken.push_back(keys[i]);
+        }
+    }
+    std::sort(taken.begin(), taken.end());
+
+    size_t renamed_count = 0;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (count(keys[i]) == 1) {
+            continue;
+        }
+        std::string name = names[i] + "_" + std::to_string(i + 1);
+        while (std::binary_search(taken.begin(), taken.end(), key(name))) {
+            name += "_" + std::to_string(i + 1);
+        }
+        taken.insert(std::upper_bound(taken.begin(), taken.end(), key(name)), key(name));
+        names[i] = name;
+        ++renamed_count;
+    }
+    if (renamed) {
+        *renamed = renamed_count;
+    }
+    return names;
+}
+
+struct BatchOptions {
+    unsigned decode_threads = 2;
+    unsigned compute_threads = 1; // 0 - по числу аппаратных потоков
+    size_t queue_capacity = 4;    // декодированных изображений, ожидающих вычислений
+};
+
+struct BatchStats {
+    size_t processed = 0;
+    size_t failed = 0;
+    double seconds = 0;
+
+    double images_per_second() const { return seconds > 0 ? processed / seconds : 0; }
+};
+
+// Конвейер пакетной обработки из трёх ступеней:
+// декодирование (decode_threads потоков) -> ограниченная очередь -> вычисления (compute_threads потоков) ->
+// запись (compute ставит задачи в encoder, у которого своя ограниченная очередь).
+// Ступени одновременно работают над разными изображениями, поэтому ввод-вывод, декодирование и вычисления
+// перекрываются, а ограниченные очереди не дают декодированию уйти далеко вперёд и ограничивают память.
+// decode и compute возвращают false при ошибке (изображение учитывается в failed).
+template <typename Decoded>
+BatchStats run_batch_pipeline(const std::vector<std::string>& inputs,
+    const std::function<bool(const std::string&, Decoded&)>& decode,
+    const std::function<bool(size_t, Decoded&)>& compute,
+    AsyncEncoder& encoder, const BatchOptions& options = BatchOptions()) {
+    const auto start = std::chrono::steady_clock::now();
+    const unsigned decode_threads = std::max(1u, options.decode_threads);
+    const unsigned compute_threads = options.compute_threads > 0
+        ? options.compute_threads : std::max(1u, std::thread::hardware_concurrency());
+
+    BoundedQueue<std::pair<size_t, Decoded>> decoded(options.queue_capacity);
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> processed{ 0 };
+    std::atomic<size_t> failed{ 0 };
+    std::atomic<unsigned> decoders_left{ decode_threads };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < decode_threads; ++t) {
+        threads.emplace_back([&] {
+            for (size_t i; (i = next++) < inputs.size();) {
+                std::pair<size_t, Decoded> item;
+                item.first = i;
+                if (decode(inputs[i], item.second)) {
+                    decoded.push(std::move(item));
+                }
+                else {
+                    ++failed;
+                }
+            }
+            // Последний завершившийся декодер закрывает очередь, и вычислители выходят, разобрав её
+            if (--decoders_left == 0) {
+                decoded.close();
+            }
+        });
+    }
+    for (unsigned t = 0; t < compute_threads; ++t) {
+        threads.emplace_back([&] {
+            std::pair<size_t, Decoded> item;
+            while (decoded.pop(item)) {
+                if (compute(item.first, item.second)) {
+                    ++processed;
+                }
+                else {
+                    ++failed;
+                }
+                item.second = Decoded();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    encoder.wait();
+
+    BatchStats stats;
+    stats.processed = processed;
+    stats.failed = failed;
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
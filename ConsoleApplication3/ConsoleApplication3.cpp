@@ -1,129 +1,748 @@
 ﻿#define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
+#include "ScratchArena.h"
+// Буферы stb_image и stb_image_write (декодированные изображения, отфильтрованные строки PNG)
+// берутся из арены промежуточных буферов
+#define STBI_MALLOC(size) ScratchArena::allocate(size)
+#define STBI_REALLOC(pointer, size) ScratchArena::reallocate(pointer, size)
+#define STBI_FREE(pointer) ScratchArena::deallocate(pointer)
+#define STBIW_MALLOC(size) ScratchArena::allocate(size)
+#define STBIW_REALLOC(pointer, size) ScratchArena::reallocate(pointer, size)
+#define STBIW_FREE(pointer) ScratchArena::deallocate(pointer)
+
 #include "stb_image.h"
+#include "PngDeflate.h"
+// PNG сжимается собственным deflate с выбором режима по уровню сжатия (см. PngDeflate.h)
+#ifndef STBIW_ZLIB_COMPRESS
+#define STBIW_ZLIB_COMPRESS png_zlib_compress
+#endif
 #include "stb_image_write.h"
+#include "BatchPipeline.h"
+#include "CpuFeatures.h"
+#include "Pnm.h"
+#include "StbImage.h"
+#include "ThreadPool.h"
 
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <functional>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 // Структура для хранения цвета пикселя в формате RGB
 struct Pixel {
     uint8_t r, g, b;
 };
+// Пиксели хранятся подряд по 3 байта, как в буферах stb_image, что позволяет обходиться без копирования
+static_assert(sizeof(Pixel) == 3, "Pixel должен совпадать с форматом RGB stb_image");
+
+// Одноканальное 8-битное изображение (градации серого).
+// Каждая строка начинается с адреса, кратного kRowAlignment; stride - шаг между строками в байтах.
+// Буфер берётся из арены промежуточных буферов (её блоки выровнены на ScratchArena::kAlignment).
+struct GrayImage {
+    static constexpr int kRowAlignment = 64;
+
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    static_assert(kRowAlignment <= ScratchArena::kAlignment, "арена не даёт нужного выравнивания строк");
+
+    ScratchVector<uint8_t> data;
+
+    GrayImage() = default;
+    GrayImage(int width, int height) { resize(width, height); }
+
+    void resize(int new_width, int new_height) {
+        width = new_width;
+        height = new_height;
+        stride = (width + kRowAlignment - 1) / kRowAlignment * kRowAlignment;
+        data.assign(static_cast<size_t>(stride) * height, 0);
+    }
+
+    uint8_t* row(int y) { return data.data() + static_cast<size_t>(y) * stride; }
+    const uint8_t* row(int y) const { return data.data() + static_cast<size_t>(y) * stride; }
+};
 
-// Функция для загрузки изображения
-bool load_image(const std::string& image_path, std::vector<Pixel>& image_data, int& width, int& height, int& channels) {
-    unsigned char* img = stbi_load(image_path.c_str(), &width, &height, &channels, 3);
-    if (!img) {
+// Функция для загрузки изображения (буфер stb_image используется без копирования)
+bool load_image(const std::string& image_path, StbImage<Pixel>& image, int& width, int& height, int& channels) {
+    image = StbImage<Pixel>::load(image_path, &channels);
+    if (image.empty()) {
         std::cerr << "Failed to load image: " << image_path << std::endl;
         return false;
     }
+    width = image.width();
+    height = image.height();
+    return true;
+}
 
-    image_data.resize(width * height);
-    for (int i = 0; i < width * height; ++i) {
-        image_data[i] = { img[i * 3], img[i * 3 + 1], img[i * 3 + 2] };
+// Сохранение одноканального изображения (PNG в градациях серого, либо бинарный PGM для расширений .pgm/.pnm;
+// строки пишутся с учётом stride)
+bool save_image(const std::string& image_path, const GrayImage& image) {
+    if (has_pgm_extension(image_path)) {
+        return write_pnm(image_path, image.data.data(), image.width, image.height, 1, image.stride);
     }
+    return stbi_write_png(image_path.c_str(), image.width, image.height, 1, image.data.data(), image.stride) != 0;
+}
 
-    stbi_image_free(img);
-    return true;
+// Яркость пикселя по BT.601 в фиксированной точке Q16 (0.299, 0.587, 0.114)
+inline uint8_t luminance(uint8_t r, uint8_t g, uint8_t b) {
+    return static_cast<uint8_t>((19595u * r + 38470u * g + 7471u * b + 32768u) >> 16);
 }
 
-// Функция для сохранения изображения
-bool save_image(const std::string& image_path, const std::vector<Pixel>& image_data, int width, int height) {
-    std::vector<unsigned char> data(image_data.size() * 3);
-    for (int i = 0; i < width * height; ++i) {
-        data[i * 3] = image_data[i].r;
-        data[i * 3 + 1] = image_data[i].g;
-        data[i * 3 + 2] = image_data[i].b;
+// Преобразование одной строки в градации серого
+void convert_row_to_grayscale(const Pixel* src, int width, uint8_t* dst) {
+    for (int x = 0; x < width; ++x) {
+        dst[x] = luminance(src[x].r, src[x].g, src[x].b);
     }
-    return stbi_write_png(image_path.c_str(), width, height, 3, data.data(), width * 3) != 0;
 }
 
 // Преобразование в градации серого
-void convert_to_grayscale(std::vector<Pixel>& image_data, int width, int height) {
-    for (int i = 0; i < width * height; ++i) {
-        uint8_t gray = 0.299 * image_data[i].r + 0.587 * image_data[i].g + 0.114 * image_data[i].b;
-        image_data[i].r = image_data[i].g = image_data[i].b = gray;
+void convert_to_grayscale(const Pixel* image_data, int width, int height, GrayImage& gray) {
+    gray.resize(width, height);
+    for (int y = 0; y < height; ++y) {
+        convert_row_to_grayscale(&image_data[static_cast<size_t>(y) * width], width, gray.row(y));
     }
 }
 
-// Применение Gaussian Blur (размытие по Гауссу)
-void apply_gaussian_blur(std::vector<Pixel>& image_data, int width, int height, int kernel_size = 5, double sigma = 1.0) {
-    const double PI = 3.14159265358979323846;
+// Одномерное ядро Гаусса в фиксированной точке Q15 (сумма весов ровно 1 << 15).
+// Двумерное ядро Гаусса сепарабельно, поэтому размытие выполняется двумя проходами:
+// горизонтальным (результат в Q8, uint16) и вертикальным (результат в uint8).
+struct GaussianKernel {
+    static constexpr int kWeightBits = 15;
+    static constexpr int kIntermediateBits = 8;
+    int radius = 0;
+    std::vector<int32_t> weights; // 2 * radius + 1 весов
+};
+
+// Режим размытия: быстрый (строки с полями, без проверок границ во внутреннем цикле)
+// или эталонный (прямой проход с ограничением координат на каждом отсчёте).
+// Оба режима используют одну и ту же целочисленную арифметику и дают побитово одинаковый результат.
+enum class BlurMode { Fast, Reference };
+
+// Генерация ядра Гаусса
+GaussianKernel make_gaussian_kernel(int kernel_size, double sigma) {
+    GaussianKernel kernel;
+    kernel.radius = std::max(kernel_size / 2, 0);
+    const int size = 2 * kernel.radius + 1;
 
-    // Генерация ядра Гаусса
-    std::vector<double> kernel(kernel_size * kernel_size);
-    int half_size = kernel_size / 2;
+    std::vector<double> values(size);
     double sum = 0.0;
-    for (int y = -half_size; y <= half_size; ++y) {
-        for (int x = -half_size; x <= half_size; ++x) {
-            double value = exp(-(x * x + y * y) / (2 * sigma * sigma)) / (2 * PI * sigma * sigma);
-            kernel[(y + half_size) * kernel_size + (x + half_size)] = value;
-            sum += value;
+    for (int i = 0; i < size; ++i) {
+        int x = i - kernel.radius;
+        values[i] = exp(-(x * x) / (2 * sigma * sigma));
+        sum += values[i];
+    }
+
+    // Квантуем нормализованное ядро, остаток округления отдаём центральному весу,
+    // чтобы сумма весов была ровно 1 << kWeightBits
+    const int32_t one = 1 << GaussianKernel::kWeightBits;
+    kernel.weights.resize(size);
+    int32_t total = 0;
+    for (int i = 0; i < size; ++i) {
+        kernel.weights[i] = static_cast<int32_t>(std::lround(values[i] / sum * one));
+        total += kernel.weights[i];
+    }
+    kernel.weights[kernel.radius] += one - total;
+    return kernel;
+}
+
+// Округление горизонтальной суммы (Q15 * uint8) до промежуточного значения Q8
+inline uint16_t round_horizontal(uint32_t acc) {
+    constexpr int shift = GaussianKernel::kWeightBits - GaussianKernel::kIntermediateBits;
+    return static_cast<uint16_t>((acc + (1u << (shift - 1))) >> shift);
+}
+
+// Округление вертикальной суммы (Q15 * Q8) до uint8
+inline uint8_t round_vertical(uint32_t acc) {
+    constexpr int shift = GaussianKernel::kWeightBits + GaussianKernel::kIntermediateBits;
+    return static_cast<uint8_t>((acc + (1u << (shift - 1))) >> shift);
+}
+
+// Горизонтальный проход по одной строке. Строка копируется в буфер с полями по radius
+// пикселей с каждой стороны (повтор крайних пикселей), поэтому внутренний цикл не проверяет границы.
+void blur_row_horizontal(const uint8_t* src, int width, const GaussianKernel& kernel,
+    std::vector<uint8_t>& padded, uint16_t* dst) {
+    const int radius = kernel.radius;
+    padded.resize(width + 2 * radius);
+    std::fill(padded.begin(), padded.begin() + radius, src[0]);
+    std::memcpy(padded.data() + radius, src, width);
+    std::fill(padded.begin() + radius + width, padded.end(), src[width - 1]);
+
+    const int32_t* weights = kernel.weights.data();
+    const int taps = 2 * radius + 1;
+    for (int x = 0; x < width; ++x) {
+        const uint8_t* p = padded.data() + x;
+        uint32_t acc = 0;
+        for (int k = 0; k < taps; ++k) {
+            acc += weights[k] * p[k];
         }
+        dst[x] = round_horizontal(acc);
     }
-    // Нормализуем ядро
-    for (auto& value : kernel) {
-        value /= sum;
+}
+
+// Вертикальный проход: rows содержит 2 * radius + 1 указателей на строки горизонтального прохода
+void blur_row_vertical(const uint16_t* const* rows, int width, const GaussianKernel& kernel,
+    std::vector<uint32_t>& acc, uint8_t* dst) {
+    acc.assign(width, 0);
+    const int taps = 2 * kernel.radius + 1;
+    for (int k = 0; k < taps; ++k) {
+        const uint32_t weight = kernel.weights[k];
+        const uint16_t* row = rows[k];
+        for (int x = 0; x < width; ++x) {
+            acc[x] += weight * row[x];
+        }
+    }
+    for (int x = 0; x < width; ++x) {
+        dst[x] = round_vertical(acc[x]);
     }
+}
 
-    // Применяем размытие
-    std::vector<Pixel> result(image_data.size());
+// Быстрое размытие одного канала. Горизонтальные строки хранятся в кольцевом буфере
+// из 2 * radius + 1 строк, поэтому размытие можно выполнять на месте (src == dst).
+void blur_plane(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride,
+    int width, int height, const GaussianKernel& kernel) {
+    const int radius = kernel.radius;
+    const int taps = 2 * radius + 1;
+    ScratchVector<uint16_t> ring(static_cast<size_t>(taps) * width);
+    std::vector<const uint16_t*> rows(taps);
+    std::vector<uint8_t> padded;
+    std::vector<uint32_t> acc;
+
+    int next_row = 0; // следующая строка для горизонтального прохода
+    for (int y = 0; y < height; ++y) {
+        int last_needed = std::min(y + radius, height - 1);
+        for (; next_row <= last_needed; ++next_row) {
+            blur_row_horizontal(src + static_cast<size_t>(next_row) * src_stride, width, kernel, padded,
+                &ring[static_cast<size_t>(next_row % taps) * width]);
+        }
+        for (int k = 0; k < taps; ++k) {
+            int py = std::min(std::max(y + k - radius, 0), height - 1);
+            rows[k] = &ring[static_cast<size_t>(py % taps) * width];
+        }
+        blur_row_vertical(rows.data(), width, kernel, acc, dst + static_cast<size_t>(y) * dst_stride);
+    }
+}
+
+// Эталонное размытие одного канала: прямой проход с ограничением координат на каждом отсчёте.
+// Медленный, но очевидный вариант для проверки быстрого режима.
+void blur_plane_reference(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride,
+    int width, int height, const GaussianKernel& kernel) {
+    const int radius = kernel.radius;
+    ScratchVector<uint8_t> result(static_cast<size_t>(width) * height);
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            double r = 0, g = 0, b = 0;
-            for (int ky = -half_size; ky <= half_size; ++ky) {
-                for (int kx = -half_size; kx <= half_size; ++kx) {
+            uint32_t vertical = 0;
+            for (int ky = -radius; ky <= radius; ++ky) {
+                int py = std::min(std::max(y + ky, 0), height - 1);
+                uint32_t horizontal = 0;
+                for (int kx = -radius; kx <= radius; ++kx) {
                     int px = std::min(std::max(x + kx, 0), width - 1);
-                    int py = std::min(std::max(y + ky, 0), height - 1);
-                    const Pixel& pixel = image_data[py * width + px];
-                    double weight = kernel[(ky + half_size) * kernel_size + (kx + half_size)];
-                    r += pixel.r * weight;
-                    g += pixel.g * weight;
-                    b += pixel.b * weight;
+                    horizontal += kernel.weights[kx + radius] * src[static_cast<size_t>(py) * src_stride + px];
                 }
+                vertical += kernel.weights[ky + radius] * round_horizontal(horizontal);
+            }
+            result[static_cast<size_t>(y) * width + x] = round_vertical(vertical);
+        }
+    }
+    for (int y = 0; y < height; ++y) {
+        std::memcpy(dst + static_cast<size_t>(y) * dst_stride, &result[static_cast<size_t>(y) * width], width);
+    }
+}
+
+// Размытие одноканального изображения на месте
+void apply_gaussian_blur(GrayImage& image, int kernel_size = 5, double sigma = 1.0, BlurMode mode = BlurMode::Fast) {
+    GaussianKernel kernel = make_gaussian_kernel(kernel_size, sigma);
+    auto blur = mode == BlurMode::Fast ? blur_plane : blur_plane_reference;
+    blur(image.row(0), image.stride, image.row(0), image.stride, image.width, image.height, kernel);
+}
+
+// Самопроверка: быстрый и эталонный режимы размытия на изображении для ядер 1..9.
+// Печатает число несовпавших пикселей для каждого ядра и возвращает true, если всё совпало.
+bool check_blur_modes(const GrayImage& image) {
+    bool identical = true;
+    for (int kernel_size = 1; kernel_size <= 9; kernel_size += 2) {
+        GrayImage fast = image;
+        GrayImage reference = image;
+        apply_gaussian_blur(fast, kernel_size, 1.0, BlurMode::Fast);
+        apply_gaussian_blur(reference, kernel_size, 1.0, BlurMode::Reference);
+        size_t mismatches = 0;
+        for (int y = 0; y < image.height; ++y) {
+            for (int x = 0; x < image.width; ++x) {
+                mismatches += fast.row(y)[x] != reference.row(y)[x];
             }
-            result[y * width + x] = { static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b) };
         }
+        std::cout << "Blur kernel " << kernel_size << ": " << mismatches << " mismatched pixels" << std::endl;
+        identical = identical && mismatches == 0;
+    }
+    return identical;
+}
+
+// Способ вычисления модуля градиента:
+// Exact - sqrt(Gx^2 + Gy^2), L1 - |Gx| + |Gy|, Approx - max + min / 2 (все с насыщением до 255)
+enum class SobelMagnitude { Exact, L1, Approx };
+
+// Набор инструкций для ядра Собеля
+enum class SimdLevel { Scalar, SSE41, AVX2 };
+
+// Лучший доступный набор инструкций
+inline SimdLevel detect_simd_level() {
+    const CpuFeatures& cpu = cpu_features();
+    return cpu.avx2 ? SimdLevel::AVX2 : cpu.sse41 ? SimdLevel::SSE41 : SimdLevel::Scalar;
+}
+
+// Модуль градиента для одного пикселя. Exact считается во float с ограничением сверху,
+// чтобы совпадать с векторными ядрами бит в бит.
+inline uint8_t sobel_magnitude(int gx, int gy, SobelMagnitude mode) {
+    int ax = std::abs(gx), ay = std::abs(gy);
+    switch (mode) {
+    case SobelMagnitude::L1:
+        return static_cast<uint8_t>(std::min(255, ax + ay));
+    case SobelMagnitude::Approx:
+        return static_cast<uint8_t>(std::min(255, std::max(ax, ay) + (std::min(ax, ay) >> 1)));
+    default: {
+        int n = gx * gx + gy * gy;
+        return n >= 255 * 255 ? 255 : static_cast<uint8_t>(std::sqrt(static_cast<float>(n)));
+    }
+    }
+}
+
+// Скалярное ядро Собеля: пиксели [x_begin, x_end) строки по трём соседним строкам
+void sobel_row_scalar(const uint8_t* r0, const uint8_t* r1, const uint8_t* r2, uint8_t* dst,
+    int x_begin, int x_end, SobelMagnitude mode) {
+    for (int x = x_begin; x < x_end; ++x) {
+        int gx = (r0[x + 1] - r0[x - 1]) + 2 * (r1[x + 1] - r1[x - 1]) + (r2[x + 1] - r2[x - 1]);
+        int gy = (r2[x - 1] + 2 * r2[x] + r2[x + 1]) - (r0[x - 1] + 2 * r0[x] + r0[x + 1]);
+        dst[x] = sobel_magnitude(gx, gy, mode);
+    }
+}
+
+#ifdef CPU_X86
+// SSE4.1: модуль градиента для 8 пикселей в int16, результат в int16 (до насыщения)
+TARGET_SSE41 inline __m128i sobel_magnitude_sse(__m128i gx, __m128i gy, SobelMagnitude mode) {
+    __m128i ax = _mm_abs_epi16(gx), ay = _mm_abs_epi16(gy);
+    if (mode == SobelMagnitude::L1) {
+        return _mm_adds_epi16(ax, ay);
+    }
+    if (mode == SobelMagnitude::Approx) {
+        return _mm_add_epi16(_mm_max_epi16(ax, ay), _mm_srli_epi16(_mm_min_epi16(ax, ay), 1));
+    }
+    const __m128 limit = _mm_set1_ps(255.0f * 255.0f);
+    __m128i lo = _mm_unpacklo_epi16(gx, gy), hi = _mm_unpackhi_epi16(gx, gy);
+    __m128 n_lo = _mm_min_ps(_mm_cvtepi32_ps(_mm_madd_epi16(lo, lo)), limit);
+    __m128 n_hi = _mm_min_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hi, hi)), limit);
+    return _mm_packs_epi32(_mm_cvttps_epi32(_mm_sqrt_ps(n_lo)), _mm_cvttps_epi32(_mm_sqrt_ps(n_hi)));
+}
+
+// SSE4.1: загрузка 8 байт с расширением до int16
+TARGET_SSE41 inline __m128i load_u8x8_sse(const uint8_t* p) {
+    return _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+}
+
+// SSE4.1: Gx и Gy для 8 пикселей (указатели на x - 1 в каждой из трёх строк)
+TARGET_SSE41 inline void sobel_gradients_sse(const uint8_t* p0, const uint8_t* p1, const uint8_t* p2,
+    __m128i& gx, __m128i& gy) {
+    __m128i a0 = load_u8x8_sse(p0), a1 = load_u8x8_sse(p0 + 1), a2 = load_u8x8_sse(p0 + 2);
+    __m128i b0 = load_u8x8_sse(p1), b2 = load_u8x8_sse(p1 + 2);
+    __m128i c0 = load_u8x8_sse(p2), c1 = load_u8x8_sse(p2 + 1), c2 = load_u8x8_sse(p2 + 2);
+    __m128i b = _mm_sub_epi16(b2, b0);
+    gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(a2, a0), _mm_sub_epi16(c2, c0)), _mm_add_epi16(b, b));
+    __m128i top = _mm_add_epi16(_mm_add_epi16(a0, a2), _mm_add_epi16(a1, a1));
+    __m128i bottom = _mm_add_epi16(_mm_add_epi16(c0, c2), _mm_add_epi16(c1, c1));
+    gy = _mm_sub_epi16(bottom, top);
+}
+
+// SSE4.1: 16 пикселей за итерацию
+TARGET_SSE41 void sobel_row_sse41(const uint8_t* r0, const uint8_t* r1, const uint8_t* r2, uint8_t* dst,
+    int width, SobelMagnitude mode) {
+    int x = 1;
+    for (; x + 16 < width; x += 16) {
+        __m128i gx_lo, gy_lo, gx_hi, gy_hi;
+        sobel_gradients_sse(r0 + x - 1, r1 + x - 1, r2 + x - 1, gx_lo, gy_lo);
+        sobel_gradients_sse(r0 + x + 7, r1 + x + 7, r2 + x + 7, gx_hi, gy_hi);
+        __m128i m = _mm_packus_epi16(sobel_magnitude_sse(gx_lo, gy_lo, mode), sobel_magnitude_sse(gx_hi, gy_hi, mode));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), m);
+    }
+    sobel_row_scalar(r0, r1, r2, dst, x, width - 1, mode);
+}
+
+// AVX2: модуль градиента для 16 пикселей в int16
+TARGET_AVX2 inline __m256i sobel_magnitude_avx2(__m256i gx, __m256i gy, SobelMagnitude mode) {
+    __m256i ax = _mm256_abs_epi16(gx), ay = _mm256_abs_epi16(gy);
+    if (mode == SobelMagnitude::L1) {
+        return _mm256_adds_epi16(ax, ay);
+    }
+    if (mode == SobelMagnitude::Approx) {
+        return _mm256_add_epi16(_mm256_max_epi16(ax, ay), _mm256_srli_epi16(_mm256_min_epi16(ax, ay), 1));
+    }
+    // unpack и packs работают внутри 128-битных половин, поэтому порядок пикселей сохраняется
+    const __m256 limit = _mm256_set1_ps(255.0f * 255.0f);
+    __m256i lo = _mm256_unpacklo_epi16(gx, gy), hi = _mm256_unpackhi_epi16(gx, gy);
+    __m256 n_lo = _mm256_min_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(lo, lo)), limit);
+    __m256 n_hi = _mm256_min_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(hi, hi)), limit);
+    return _mm256_packs_epi32(_mm256_cvttps_epi32(_mm256_sqrt_ps(n_lo)), _mm256_cvttps_epi32(_mm256_sqrt_ps(n_hi)));
+}
+
+// AVX2: загрузка 16 байт с расширением до int16
+TARGET_AVX2 inline __m256i load_u8x16_avx2(const uint8_t* p) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+// AVX2: Gx и Gy для 16 пикселей
+TARGET_AVX2 inline void sobel_gradients_avx2(const uint8_t* p0, const uint8_t* p1, const uint8_t* p2,
+    __m256i& gx, __m256i& gy) {
+    __m256i a0 = load_u8x16_avx2(p0), a1 = load_u8x16_avx2(p0 + 1), a2 = load_u8x16_avx2(p0 + 2);
+    __m256i b0 = load_u8x16_avx2(p1), b2 = load_u8x16_avx2(p1 + 2);
+    __m256i c0 = load_u8x16_avx2(p2), c1 = load_u8x16_avx2(p2 + 1), c2 = load_u8x16_avx2(p2 + 2);
+    __m256i b = _mm256_sub_epi16(b2, b0);
+    gx = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(a2, a0), _mm256_sub_epi16(c2, c0)), _mm256_add_epi16(b, b));
+    __m256i top = _mm256_add_epi16(_mm256_add_epi16(a0, a2), _mm256_add_epi16(a1, a1));
+    __m256i bottom = _mm256_add_epi16(_mm256_add_epi16(c0, c2), _mm256_add_epi16(c1, c1));
+    gy = _mm256_sub_epi16(bottom, top);
+}
+
+// AVX2: 32 пикселя за итерацию
+TARGET_AVX2 void sobel_row_avx2(const uint8_t* r0, const uint8_t* r1, const uint8_t* r2, uint8_t* dst,
+    int width, SobelMagnitude mode) {
+    int x = 1;
+    for (; x + 32 < width; x += 32) {
+        __m256i gx_lo, gy_lo, gx_hi, gy_hi;
+        sobel_gradients_avx2(r0 + x - 1, r1 + x - 1, r2 + x - 1, gx_lo, gy_lo);
+        sobel_gradients_avx2(r0 + x + 15, r1 + x + 15, r2 + x + 15, gx_hi, gy_hi);
+        __m256i m = _mm256_packus_epi16(sobel_magnitude_avx2(gx_lo, gy_lo, mode), sobel_magnitude_avx2(gx_hi, gy_hi, mode));
+        // packus чередует 128-битные половины, возвращаем пиксели по порядку
+        m = _mm256_permute4x64_epi64(m, 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), m);
+    }
+    sobel_row_scalar(r0, r1, r2, dst, x, width - 1, mode);
+}
+#endif
+
+// Одна строка фильтра Собеля (пиксели 1 .. width - 2) выбранным набором инструкций
+void sobel_row(const uint8_t* r0, const uint8_t* r1, const uint8_t* r2, uint8_t* dst,
+    int width, SobelMagnitude mode, SimdLevel level) {
+#ifdef CPU_X86
+    if (level == SimdLevel::AVX2) {
+        sobel_row_avx2(r0, r1, r2, dst, width, mode);
+        return;
+    }
+    if (level == SimdLevel::SSE41) {
+        sobel_row_sse41(r0, r1, r2, dst, width, mode);
+        return;
+    }
+#endif
+    sobel_row_scalar(r0, r1, r2, dst, 1, width - 1, mode);
+}
+
+// Применение фильтра Собеля для выделения границ (крайние строки и столбцы остаются нулевыми)
+void apply_sobel_filter(const GrayImage& image, GrayImage& result, SobelMagnitude mode = SobelMagnitude::Exact,
+    SimdLevel level = detect_simd_level()) {
+    result.resize(image.width, image.height);
+    for (int y = 1; y < image.height - 1; ++y) {
+        sobel_row(image.row(y - 1), image.row(y), image.row(y + 1), result.row(y), image.width, mode, level);
     }
-    image_data = result;
 }
 
-// Применение фильтра Собеля для выделения границ
-void apply_sobel_filter(const std::vector<Pixel>& image_data, std::vector<Pixel>& result, int width, int height) {
-    std::vector<int> sobel_x = { -1, 0, 1, -2, 0, 2, -1, 0, 1 };
-    std::vector<int> sobel_y = { -1, -2, -1, 0, 0, 0, 1, 2, 1 };
+// Самопроверка векторных ядер Собеля: для каждого способа вычисления модуля градиента результаты SSE4.1 и AVX2
+// (если доступны) сравниваются со скалярным ядром на изображении и на синтетических строках ширины 1..257,
+// где проверяются все варианты хвоста строки. Печатает число несовпавших пикселей, true - всё совпало.
+bool check_sobel_levels(const GrayImage& image) {
+    const SobelMagnitude modes[] = { SobelMagnitude::Exact, SobelMagnitude::L1, SobelMagnitude::Approx };
+    const char* const mode_names[] = { "exact", "l1", "approx" };
+    std::vector<SimdLevel> levels;
+    if (detect_simd_level() != SimdLevel::Scalar) {
+        levels.push_back(SimdLevel::SSE41);
+    }
+    if (detect_simd_level() == SimdLevel::AVX2) {
+        levels.push_back(SimdLevel::AVX2);
+    }
+
+    // Синтетические изображения высотой 3 с псевдослучайными яркостями (от резких перепадов до ровных участков)
+    std::vector<GrayImage> images = { image };
+    uint32_t state = 12345;
+    for (int width = 1; width <= 257; ++width) {
+        GrayImage synthetic(width, 3);
+        for (int y = 0; y < 3; ++y) {
+            for (int x = 0; x < width; ++x) {
+                state = state * 1664525u + 1013904223u;
+                synthetic.row(y)[x] = static_cast<uint8_t>(state >> 24);
+            }
+        }
+        images.push_back(std::move(synthetic));
+    }
 
-    result.resize(image_data.size());
-    for (int y = 1; y < height - 1; ++y) {
-        for (int x = 1; x < width - 1; ++x) {
-            int gx = 0, gy = 0;
-            for (int ky = -1; ky <= 1; ++ky) {
-                for (int kx = -1; kx <= 1; ++kx) {
-                    int px = x + kx;
-                    int py = y + ky;
-                    int weight_x = sobel_x[(ky + 1) * 3 + (kx + 1)];
-                    int weight_y = sobel_y[(ky + 1) * 3 + (kx + 1)];
-                    gx += weight_x * image_data[py * width + px].r;
-                    gy += weight_y * image_data[py * width + px].r;
+    bool identical = true;
+    for (SimdLevel level : levels) {
+        for (int m = 0; m < 3; ++m) {
+            size_t mismatches = 0;
+            for (const GrayImage& input : images) {
+                GrayImage scalar, vector;
+                apply_sobel_filter(input, scalar, modes[m], SimdLevel::Scalar);
+                apply_sobel_filter(input, vector, modes[m], level);
+                for (int y = 0; y < input.height; ++y) {
+                    for (int x = 0; x < input.width; ++x) {
+                        mismatches += scalar.row(y)[x] != vector.row(y)[x];
+                    }
                 }
             }
-            int magnitude = std::sqrt(gx * gx + gy * gy);
-            magnitude = std::min(255, std::max(0, magnitude));
-            result[y * width + x] = { static_cast<uint8_t>(magnitude), static_cast<uint8_t>(magnitude), static_cast<uint8_t>(magnitude) };
+            std::cout << "Sobel " << mode_names[m] << " " << (level == SimdLevel::AVX2 ? "AVX2" : "SSE4.1")
+                << " vs scalar: " << mismatches << " mismatched pixels" << std::endl;
+            identical = identical && mismatches == 0;
         }
     }
+    if (levels.empty()) {
+        std::cout << "Sobel: no vector kernels on this CPU, nothing to compare" << std::endl;
+    }
+    return identical;
+}
+
+// Источник строк RGB для слитого конвейера: возвращает строку y (строки запрашиваются по возрастанию)
+using RgbRowSource = std::function<const Pixel*(int y)>;
+// Приёмник готовых строк результата: строка y шириной width
+using GrayRowSink = std::function<void(int y, const uint8_t* row)>;
+
+// Слитый конвейер градации серого -> размытие -> Собель.
+// Строки выхода [y_begin, y_end) отдаются в sink по порядку. Вместо полных промежуточных изображений
+// хранятся только 2 * radius + 1 строк горизонтального прохода размытия и 3 размытые строки,
+// поэтому память O(width * kernel_size). Результат побитово совпадает с поэтапным конвейером.
+void run_fused_edge_pipeline(const RgbRowSource& source, int width, int height, int y_begin, int y_end,
+    const GaussianKernel& kernel, SobelMagnitude mode, const GrayRowSink& sink,
+    SimdLevel level = detect_simd_level()) {
+    const int radius = kernel.radius;
+    const int taps = 2 * radius + 1;
+
+    std::vector<uint8_t> gray(width);
+    ScratchVector<uint16_t> horizontal_ring(static_cast<size_t>(taps) * width);
+    std::vector<uint8_t> blurred_ring(3 * static_cast<size_t>(width));
+    std::vector<uint8_t> output(width, 0);
+    std::vector<uint8_t> zeros(width, 0);
+    std::vector<const uint16_t*> rows(taps);
+    std::vector<uint8_t> padded;
+    std::vector<uint32_t> acc;
+
+    auto horizontal_row = [&](int y) { return &horizontal_ring[static_cast<size_t>(y % taps) * width]; };
+    auto blurred_row = [&](int y) { return &blurred_ring[static_cast<size_t>(y % 3) * width]; };
+
+    // Строка Собеля y читает размытые строки y - 1 .. y + 1, размытая строка b - строки серого b - radius .. b + radius
+    int next_blurred = std::max(y_begin - 1, 0);
+    int next_gray = std::max(next_blurred - radius, 0);
+    auto ensure_blurred = [&](int last) {
+        for (; next_blurred <= last; ++next_blurred) {
+            int last_gray = std::min(next_blurred + radius, height - 1);
+            for (; next_gray <= last_gray; ++next_gray) {
+                convert_row_to_grayscale(source(next_gray), width, gray.data());
+                blur_row_horizontal(gray.data(), width, kernel, padded, horizontal_row(next_gray));
+            }
+            for (int k = 0; k < taps; ++k) {
+                rows[k] = horizontal_row(std::min(std::max(next_blurred + k - radius, 0), height - 1));
+            }
+            blur_row_vertical(rows.data(), width, kernel, acc, blurred_row(next_blurred));
+        }
+    };
+
+    for (int y = y_begin; y < y_end; ++y) {
+        if (y == 0 || y == height - 1) {
+            sink(y, zeros.data());
+            continue;
+        }
+        ensure_blurred(y + 1);
+        sobel_row(blurred_row(y - 1), blurred_row(y), blurred_row(y + 1), output.data(), width, mode, level);
+        sink(y, output.data());
+    }
+}
+
+// Многопоточный конвейер: изображение делится на горизонтальные полосы, каждая полоса считается
+// слитым конвейером в задаче пула. Граничные строки (halo) полоса дочитывает из источника сама,
+// а готовые строки пишет прямо в свои строки result, поэтому склейка полос не требует копирования.
+void run_striped_edge_pipeline(const RgbRowSource& source, int width, int height, const GaussianKernel& kernel,
+    SobelMagnitude mode, ThreadPool& pool, GrayImage& result) {
+    result.resize(width, height);
+
+    // Полос в несколько раз больше, чем потоков, чтобы перехват работы выравнивал нагрузку;
+    // нижняя граница высоты ограничивает долю повторно считаемых граничных строк
+    const int min_stripe_height = 4 * (2 * kernel.radius + 3);
+    int stripes = std::max(1, std::min(static_cast<int>(pool.size()) * 4, height / std::max(min_stripe_height, 1)));
+    int stripe_height = (height + stripes - 1) / std::max(stripes, 1);
+
+    pool.parallel_for(stripes, [&](int stripe) {
+        int y_begin = stripe * stripe_height;
+        int y_end = std::min(height, y_begin + stripe_height);
+        run_fused_edge_pipeline(source, width, height, y_begin, y_end, kernel, mode,
+            [&](int y, const uint8_t* row) { std::memcpy(result.row(y), row, width); });
+    });
+}
+
+// Пакетная обработка: изображения из каталога или файла-списка, результаты пишутся в out_dir
+// под именами входных файлов с расширением out_extension (совпадающие имена получают номер входа,
+// см. batch_output_names). Каждое изображение считается слитым
+// конвейером в одном потоке, параллельно обрабатываются разные изображения.
+int run_batch(const std::string& batch_path, const std::string& out_dir, const std::string& out_extension,
+    unsigned threads, SobelMagnitude sobel) {
+    std::vector<std::string> inputs = collect_batch_inputs(batch_path);
+    if (inputs.empty()) {
+        std::cerr << "No input images in " << batch_path << std::endl;
+        return 1;
+    }
+    size_t renamed = 0;
+    const std::vector<std::string> output_names = batch_output_names(inputs, &renamed);
+    if (renamed > 0) {
+        std::cerr << renamed << " inputs share a file name; their outputs get the input number appended" << std::endl;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(out_dir, error);
+
+    const GaussianKernel kernel = make_gaussian_kernel(5, 1.0);
+    AsyncEncoder encoder;
+    std::atomic<size_t> save_failures{ 0 };
+    BatchOptions options;
+    options.compute_threads = threads;
+
+    BatchStats stats = run_batch_pipeline<StbImage<Pixel>>(inputs,
+        [](const std::string& path, StbImage<Pixel>& image) {
+            image = StbImage<Pixel>::load(path);
+            if (image.empty()) {
+                std::cerr << "Failed to load image: " << path << std::endl;
+                return false;
+            }
+            return true;
+        },
+        [&](size_t index, StbImage<Pixel>& image) {
+            const int width = image.width();
+            const int height = image.height();
+            GrayImage sobel_image(width, height);
+            run_fused_edge_pipeline([&](int y) { return image.row(y); }, width, height, 0, height, kernel,
+                sobel, [&](int y, const uint8_t* row) { std::memcpy(sobel_image.row(y), row, width); });
+
+            std::string output = (std::filesystem::path(out_dir) / (output_names[index] + "." + out_extension)).string();
+            encoder.submit([output, sobel_image = std::move(sobel_image), &save_failures] {
+                if (!save_image(output, sobel_image)) {
+                    std::cerr << "Failed to save image: " << output << std::endl;
+                    ++save_failures;
+                }
+            });
+            return true;
+        },
+        encoder, options);
+
+    std::cout << "Processed " << stats.processed - save_failures << " of " << inputs.size() << " images in "
+        << stats.seconds << " s (" << stats.images_per_second() << " images/s)" << std::endl;
+    return stats.failed == 0 && save_failures == 0 ? 0 : 1;
+}
+
+// Вывод справки по параметрам командной строки
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [input_image] [output_image] [--fused] [--threads N] [--self-check]"
+        << " [--sobel exact|l1|approx]"
+        << " [--png-level N] [--png-filter auto|none|sub|up|avg|paeth]" << std::endl
+        << "       " << program << " --batch dir|list_file [--out-dir DIR] [--out-ext png|pgm] [--threads N] [--sobel MODE]" << std::endl
+        << "  --threads N  process horizontal stripes on N threads (0 - all cores);" << std::endl
+        << "               in batch mode - process N images at a time" << std::endl
+        << "  --png-level N  0 - stored, 1 - RLE (fastest for edge maps), 2+ - LZ77 (default 8)" << std::endl
+        << "  --png-filter F  fixed PNG row filter instead of trying all five per row" << std::endl
+        << "  output_image with .pgm/.pnm extension is written as uncompressed binary PGM (P5)" << std::endl
+        << "  --sobel MODE  gradient magnitude: exact - sqrt(gx^2 + gy^2) (default), l1 - |gx| + |gy|," << std::endl
+        << "                approx - max + min / 2" << std::endl
+        << "  --self-check  compare fast and reference blur and scalar and SSE4.1/AVX2 Sobel kernels" << std::endl
+        << "                on input_image and exit (1 on mismatch)" << std::endl;
 }
 
 // Основная функция
-int main() {
+int main(int argc, char* argv[]) {
     std::string input_image = "example2.jpg";
     std::string output_image = "output2.png";
+    bool fused = false;
+    bool self_check = false;
+    SobelMagnitude sobel = SobelMagnitude::Exact;
+    int threads = 1;
+    std::string batch_path;
+    std::string out_dir = ".";
+    std::string out_extension = "png";
+
+    // Разбор параметров командной строки
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--fused") {
+            fused = true;
+        }
+        else if (arg == "--self-check") {
+            self_check = true;
+        }
+        else if (arg == "--sobel" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "exact") {
+                sobel = SobelMagnitude::Exact;
+            }
+            else if (mode == "l1") {
+                sobel = SobelMagnitude::L1;
+            }
+            else if (mode == "approx") {
+                sobel = SobelMagnitude::Approx;
+            }
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+            if (threads < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--batch" && i + 1 < argc) {
+            batch_path = argv[++i];
+        }
+        else if (arg == "--out-dir" && i + 1 < argc) {
+            out_dir = argv[++i];
+        }
+        else if (arg == "--out-ext" && i + 1 < argc) {
+            // Формат записи выбирается по расширению (см. save_image), поэтому другие расширения не допускаются
+            out_extension = argv[++i];
+            if (out_extension != "png" && out_extension != "pgm") {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--png-level" && i + 1 < argc) {
+            stbi_write_png_compression_level = std::atoi(argv[++i]);
+        }
+        else if (arg == "--png-filter" && i + 1 < argc) {
+            // Номера фильтров PNG: 0 - none, 1 - sub, 2 - up, 3 - avg, 4 - paeth; -1 - подбор для каждой строки
+            static const char* const filters[] = { "none", "sub", "up", "avg", "paeth" };
+            std::string filter = argv[++i];
+            auto it = std::find(std::begin(filters), std::end(filters), filter);
+            if (it != std::end(filters)) {
+                stbi_write_force_png_filter = static_cast<int>(it - std::begin(filters));
+            }
+            else if (filter == "auto") {
+                stbi_write_force_png_filter = -1;
+            }
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!arg.empty() && arg[0] != '-' && positional < 2) {
+            (positional++ == 0 ? input_image : output_image) = arg;
+        }
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
 
-    std::vector<Pixel> image_data;
+    if (!batch_path.empty()) {
+        return run_batch(batch_path, out_dir, out_extension, static_cast<unsigned>(threads), sobel);
+    }
+
+    StbImage<Pixel> image_data;
     int width, height, channels;
 
     // Загрузка изображения
@@ -131,18 +750,44 @@ int main() {
         return 1;
     }
 
-    // Преобразование в градации серого
-    convert_to_grayscale(image_data, width, height);
+    if (self_check) {
+        GrayImage gray_image;
+        convert_to_grayscale(image_data.data(), width, height, gray_image);
+        bool blur_ok = check_blur_modes(gray_image);
+        bool sobel_ok = check_sobel_levels(gray_image);
+        return blur_ok && sobel_ok ? 0 : 1;
+    }
 
-    // Применение Gaussian Blur
-    apply_gaussian_blur(image_data, width, height, 5, 1.0);
+    GrayImage sobel_image;
+    if (threads != 1) {
+        // Полосы на пуле потоков (каждая полоса - слитый конвейер)
+        ThreadPool pool(static_cast<unsigned>(threads));
+        run_striped_edge_pipeline(
+            [&](int y) { return image_data.row(y); },
+            width, height, make_gaussian_kernel(5, 1.0), sobel, pool, sobel_image);
+    }
+    else if (fused) {
+        // Слитый конвейер: промежуточные изображения не создаются, строки Собеля сразу пишутся в результат
+        sobel_image.resize(width, height);
+        run_fused_edge_pipeline(
+            [&](int y) { return image_data.row(y); },
+            width, height, 0, height, make_gaussian_kernel(5, 1.0), sobel,
+            [&](int y, const uint8_t* row) { std::memcpy(sobel_image.row(y), row, width); });
+    }
+    else {
+        // Преобразование в градации серого (дальше конвейер работает с одним каналом)
+        GrayImage gray_image;
+        convert_to_grayscale(image_data.data(), width, height, gray_image);
 
-    // Применение фильтра Собеля
-    std::vector<Pixel> sobel_image;
-    apply_sobel_filter(image_data, sobel_image, width, height);
+        // Применение Gaussian Blur
+        apply_gaussian_blur(gray_image, 5, 1.0);
+
+        // Применение фильтра Собеля
+        apply_sobel_filter(gray_image, sobel_image, sobel);
+    }
 
     // Сохранение результата
-    if (!save_image(output_image, sobel_image, width, height)) {
+    if (!save_image(output_image, sobel_image)) {
         std::cerr << "Failed to save image: " << output_image << std::endl;
         return 1;
     }
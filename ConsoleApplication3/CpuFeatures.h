@@ -0,0 +1,54 @@
+﻿#pragma once
+
+// Общие для обоих инструментов средства x86: интринсики, атрибуты целевого набора инструкций
+// и определение возможностей процессора
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC разрешает интринсики любого набора инструкций без флагов компилятора,
+// GCC и Clang требуют пометить функцию целевым набором
+#if defined(CPU_X86) && !defined(_MSC_VER)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+// Наборы инструкций, которые поддерживают процессор и ОС
+struct CpuFeatures {
+    bool sse41 = false;
+    bool avx2 = false; // вместе с сохранением регистров YMM операционной системой
+};
+
+// Возможности процессора (определяются один раз за запуск)
+inline const CpuFeatures& cpu_features() {
+    static const CpuFeatures features = [] {
+        CpuFeatures result;
+#if defined(CPU_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int max_leaf = info[0];
+        __cpuid(info, 1);
+        result.sse41 = (info[2] & (1 << 19)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            result.avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#elif defined(CPU_X86)
+        __builtin_cpu_init();
+        result.sse41 = __builtin_cpu_supports("sse4.1") != 0;
+        result.avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+        return result;
+    }();
+    return features;
+}
@@ -1,55 +1,90 @@
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
+#include "ScratchArena.h"
+//  stb_image  stb_image_write ( ,   PNG)
+//     
+#define STBI_MALLOC(size) ScratchArena::allocate(size)
+#define STBI_REALLOC(pointer, size) ScratchArena::reallocate(pointer, size)
+#define STBI_FREE(pointer) ScratchArena::deallocate(pointer)
+#define STBIW_MALLOC(size) ScratchArena::allocate(size)
+#define STBIW_REALLOC(pointer, size) ScratchArena::reallocate(pointer, size)
+#define STBIW_FREE(pointer) ScratchArena::deallocate(pointer)
+
 #include "stb_image.h"
+#include "PngDeflate.h"
+// PNG   deflate       (. PngDeflate.h)
+#ifndef STBIW_ZLIB_COMPRESS
+#define STBIW_ZLIB_COMPRESS png_zlib_compress
+#endif
 #include "stb_image_write.h"
+#include "AsyncEncoder.h"
+#include "BatchPipeline.h"
+#include "CpuFeatures.h"
+#include "Pnm.h"
+#include "StbImage.h"
+#include "ThreadPool.h"
 #include <iostream>
 #include <vector>
 #include <string>
 #include <fstream>
+#include <memory>
 #include <cmath>
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <tuple>
+#include <functional>
+#include <random>
+#include <filesystem>
 
 //   RGB 
 struct RGB {
     unsigned char r, g, b;
 };
+//     3 ,    stb_image,     
+static_assert(sizeof(RGB) == 3, "RGB     stb_image");
+
+//   :  [x_begin, x_end)  y
+struct Run {
+    int y, x_begin, x_end;
+};
 
-//   
+//   :     
+//    ,      
 struct Component {
-    std::vector<std::pair<int, int>> pixels;
+    std::vector<Run> runs;
+    int area = 0;
+    int min_x = 0, min_y = 0, max_x = 0, max_y = 0;
+    int top_left_x = 0, top_left_y = 0; //     ( ,   )
 };
 
-//    
-std::vector<RGB> load_image(const std::string& image_path, int& width, int& height) {
-    int channels;
-    unsigned char* data = stbi_load(image_path.c_str(), &width, &height, &channels, 3);
-    if (!data) {
+//     ( stb_image   )
+StbImage<RGB> load_image(const std::string& image_path, int& width, int& height) {
+    StbImage<RGB> image = StbImage<RGB>::load(image_path);
+    if (image.empty()) {
         std::cerr << ":    !" << std::endl;
         exit(1);
     }
-
-    std::vector<RGB> image;
-    image.reserve(width * height);
-
-    for (int i = 0; i < width * height * 3; i += 3) {
-        image.push_back({ data[i], data[i + 1], data[i + 2] });
-    }
-
-    stbi_image_free(data);
+    width = image.width();
+    height = image.height();
     return image;
 }
 
 //     JPG
-void save_image_jpg(const std::string& filename, const std::vector<RGB>& image, int width, int height) {
-    std::vector<unsigned char> image_data;
-    image_data.reserve(width * height * 3);
-    for (const auto& pixel : image) {
-        image_data.push_back(pixel.r);
-        image_data.push_back(pixel.g);
-        image_data.push_back(pixel.b);
-    }
-    stbi_write_jpg(filename.c_str(), width, height, 3, image_data.data(), 100);
+void save_image_jpg(const std::string& filename, const RGB* image, int width, int height) {
+    stbi_write_jpg(filename.c_str(), width, height, 3, image, 100);
+}
+
+//     PPM (P6)  
+void save_image_ppm(const std::string& filename, const RGB* image, int width, int height) {
+    write_pnm(filename, &image->r, width, height, 3, static_cast<size_t>(width) * 3);
+}
+
+//     PNG (channels   ,  )
+void save_image_png(const std::string& filename, const unsigned char* data, int width, int height, int channels) {
+    stbi_write_png(filename.c_str(), width, height, channels, data, width * channels);
 }
 
 //    K-Means
@@ -111,154 +146,1299 @@ void kmeans(const std::vector<RGB>& pixels, std::vector<int>& labels, std::vecto
     } while (changed);
 }
 */
-//  K-Means   
-void kmeans(const std::vector<RGB>& pixels, std::vector<int>& labels, std::vector<RGB>& centers, int n_clusters) {
-    std::vector<int> counts(n_clusters, 0);
-    labels.resize(pixels.size());
+//     :     1 << kCenterFractionBits,
+//      unsigned char   
+constexpr int kCenterFractionBits = 6;
 
-    //     
-    centers.resize(n_clusters);
-    for (int i = 0; i < n_clusters; ++i) {
-        centers[i] = pixels[rand() % pixels.size()];
+struct Center {
+    int32_t r, g, b;
+};
+
+inline Center to_center(const RGB& color) {
+    return { color.r << kCenterFractionBits, color.g << kCenterFractionBits, color.b << kCenterFractionBits };
+}
+
+//      RGB
+inline RGB to_rgb(const Center& center) {
+    const int32_t half = 1 << (kCenterFractionBits - 1);
+    return { static_cast<unsigned char>((center.r + half) >> kCenterFractionBits),
+        static_cast<unsigned char>((center.g + half) >> kCenterFractionBits),
+        static_cast<unsigned char>((center.b + half) >> kCenterFractionBits) };
+}
+
+//         .
+//      ,    ,  sqrt  pow  .
+//  3 * (255 << 6)^2 < 2^31,   int32.
+inline int32_t squared_distance(const RGB& pixel, const Center& center) {
+    int32_t dr = (pixel.r << kCenterFractionBits) - center.r;
+    int32_t dg = (pixel.g << kCenterFractionBits) - center.g;
+    int32_t db = (pixel.b << kCenterFractionBits) - center.b;
+    return dr * dr + dg * dg + db * db;
+}
+
+//    (   -  ), distance -    
+inline int nearest_center(const RGB& pixel, const std::vector<Center>& centers, int32_t* distance = nullptr) {
+    int32_t min_dist = squared_distance(pixel, centers[0]);
+    int min_index = 0;
+    for (int j = 1; j < static_cast<int>(centers.size()); ++j) {
+        int32_t dist = squared_distance(pixel, centers[j]);
+        if (dist < min_dist) {
+            min_dist = dist;
+            min_index = j;
+        }
     }
+    if (distance) {
+        *distance = min_dist;
+    }
+    return min_index;
+}
 
-    bool changed;
-    do {
-        changed = false;
-        //  1:         
-        for (size_t i = 0; i < pixels.size(); ++i) {
-            double min_dist = std::sqrt(std::pow(pixels[i].r - centers[0].r, 2) +
-                std::pow(pixels[i].g - centers[0].g, 2) +
-                std::pow(pixels[i].b - centers[0].b, 2));
-            int min_index = 0;
+//      ,   
+inline int32_t center_mean(int64_t sum, int64_t count) {
+    return static_cast<int32_t>(((sum << kCenterFractionBits) + count / 2) / count);
+}
 
-            for (int j = 1; j < n_clusters; ++j) {
-                double dist = std::sqrt(std::pow(pixels[i].r - centers[j].r, 2) +
-                    std::pow(pixels[i].g - centers[j].g, 2) +
-                    std::pow(pixels[i].b - centers[j].b, 2));
-                if (dist < min_dist) {
-                    min_dist = dist;
-                    min_index = j;
+//   k-means  :
+// None -   , Exact -     (   None),
+// Quantized -  3D-  histogram_bits    
+enum class ColorHistogram { None, Exact, Quantized };
+
+//    k-means    
+enum class KMeansSeeding {
+    Random, //       ( )
+    PlusPlus, // k-means++:         
+    Parallel // k-means||:     ,   
+};
+
+//  : Lloyd -       ,
+// Hamerly -        (  ),
+// MiniBatch -         (     )
+enum class KMeansAlgorithm { Lloyd, Hamerly, MiniBatch };
+
+//      k-means
+enum class SimdLevel { Scalar, AVX2 };
+
+//    
+inline SimdLevel detect_simd_level() {
+    return cpu_features().avx2 ? SimdLevel::AVX2 : SimdLevel::Scalar;
+}
+
+//  k-means
+struct KMeansOptions {
+    ColorHistogram histogram = ColorHistogram::None;
+    int histogram_bits = 5; // 5  6     Quantized
+    ThreadPool* pool = nullptr; //      (nullptr -   )
+    KMeansSeeding seeding = KMeansSeeding::PlusPlus;
+    uint64_t seed = 0; //  std::mt19937_64    
+    //        7      
+    KMeansAlgorithm algorithm = detect_simd_level() == SimdLevel::AVX2 ? KMeansAlgorithm::Lloyd : KMeansAlgorithm::Hamerly;
+
+    //   (  -   ,       )
+    int max_iterations = 0; // 0 -  
+    double tolerance = 0; //        , 0 -  
+    double min_changed_fraction = 0; //  ,  , 0 -  
+
+    int mini_batch_size = 4096; //     KMeansAlgorithm::MiniBatch (  - max_iterations)
+    SimdLevel simd = detect_simd_level(); //    (    )
+};
+
+//   k-means
+enum class KMeansStop { Converged, MaxIterations, Tolerance, ChangedFraction };
+
+//    
+struct KMeansIteration {
+    int iteration = 0;
+    uint64_t changed = 0; //   
+    double changed_fraction = 0;
+    double max_shift = 0; //      
+};
+
+struct KMeansStats {
+    std::vector<KMeansIteration> iterations;
+    KMeansStop stop = KMeansStop::Converged;
+};
+
+inline const char* stop_reason(KMeansStop stop) {
+    switch (stop) {
+    case KMeansStop::MaxIterations:
+        return " ";
+    case KMeansStop::Tolerance:
+        return "   ";
+    case KMeansStop::ChangedFraction:
+        return "   ";
+    default:
+        return "";
+    }
+}
+
+//  :           
+struct ColorPalette {
+    ScratchVector<RGB> colors;
+    ScratchVector<uint32_t> weights;
+    ScratchVector<uint32_t> pixel_to_color;
+};
+
+inline uint32_t color_key(const RGB& color) {
+    return (static_cast<uint32_t>(color.r) << 16) | (static_cast<uint32_t>(color.g) << 8) | color.b;
+}
+
+//    (-     24-  )
+ColorPalette build_exact_palette(const ScratchVector<RGB>& pixels) {
+    const uint32_t empty = 0xFFFFFFFFu;
+    ColorPalette palette;
+    palette.pixel_to_color.resize(pixels.size());
+
+    size_t capacity = 1 << 16;
+    ScratchVector<uint32_t> keys(capacity, empty);
+    ScratchVector<uint32_t> slots(capacity);
+    auto find_slot = [&](uint32_t key) {
+        size_t mask = keys.size() - 1;
+        size_t h = (key * 0x9E3779B1u) & mask;
+        while (keys[h] != empty && keys[h] != key) {
+            h = (h + 1) & mask;
+        }
+        return h;
+    };
+
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        uint32_t key = color_key(pixels[i]);
+        size_t h = find_slot(key);
+        if (keys[h] == empty) {
+            keys[h] = key;
+            slots[h] = static_cast<uint32_t>(palette.colors.size());
+            palette.colors.push_back(pixels[i]);
+            palette.weights.push_back(0);
+
+            //      
+            if (palette.colors.size() * 2 > keys.size()) {
+                capacity = keys.size() * 2;
+                keys.assign(capacity, empty);
+                slots.resize(capacity);
+                for (uint32_t c = 0; c < palette.colors.size(); ++c) {
+                    size_t slot = find_slot(color_key(palette.colors[c]));
+                    keys[slot] = color_key(palette.colors[c]);
+                    slots[slot] = c;
                 }
+                h = find_slot(key);
             }
+        }
+        uint32_t index = slots[h];
+        palette.weights[index]++;
+        palette.pixel_to_color[i] = index;
+    }
+    return palette;
+}
 
-            if (labels[i] != min_index) {
-                labels[i] = min_index;
-                changed = true;
+//   3D-:   -      
+ColorPalette build_quantized_palette(const ScratchVector<RGB>& pixels, int bits) {
+    bits = std::min(std::max(bits, 1), 8);
+    const int shift = 8 - bits;
+    const size_t bins = size_t(1) << (3 * bits);
+    auto bin_of = [&](const RGB& c) {
+        return ((size_t(c.r) >> shift) << (2 * bits)) | ((size_t(c.g) >> shift) << bits) | (size_t(c.b) >> shift);
+    };
+
+    ScratchVector<uint32_t> counts(bins, 0);
+    ScratchVector<uint64_t> sums(3 * bins, 0);
+    for (const auto& pixel : pixels) {
+        size_t bin = bin_of(pixel);
+        counts[bin]++;
+        sums[3 * bin] += pixel.r;
+        sums[3 * bin + 1] += pixel.g;
+        sums[3 * bin + 2] += pixel.b;
+    }
+
+    ColorPalette palette;
+    ScratchVector<uint32_t> bin_to_color(bins);
+    for (size_t bin = 0; bin < bins; ++bin) {
+        if (counts[bin] == 0) {
+            continue;
+        }
+        uint64_t n = counts[bin];
+        bin_to_color[bin] = static_cast<uint32_t>(palette.colors.size());
+        palette.colors.push_back({ static_cast<unsigned char>((sums[3 * bin] + n / 2) / n),
+            static_cast<unsigned char>((sums[3 * bin + 1] + n / 2) / n),
+            static_cast<unsigned char>((sums[3 * bin + 2] + n / 2) / n) });
+        palette.weights.push_back(counts[bin]);
+    }
+
+    palette.pixel_to_color.resize(pixels.size());
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        palette.pixel_to_color[i] = bin_to_color[bin_of(pixels[i])];
+    }
+    return palette;
+}
+
+//   .     -,
+//  ,   ,    (false sharing).
+struct alignas(64) ClusterSum {
+    int64_t r = 0, g = 0, b = 0, count = 0;
+};
+
+//      .      ,
+//       ,       .
+constexpr size_t kLloydBlockSize = 1 << 16;
+
+//  body(block)     -      
+inline void for_each_block(size_t blocks, ThreadPool* pool, const std::function<void(int)>& body) {
+    if (pool) {
+        pool->parallel_for(static_cast<int>(blocks), body);
+    }
+    else {
+        for (size_t block = 0; block < blocks; ++block) {
+            body(static_cast<int>(block));
+        }
+    }
+}
+
+//        (   -  )
+struct FarthestPoint {
+    int32_t distance = -1;
+    size_t index = 0;
+};
+
+//          (  -  int32)
+inline int nearest_two_centers(const RGB& pixel, const std::vector<Center>& centers, int32_t& nearest, int32_t& second) {
+    nearest = squared_distance(pixel, centers[0]);
+    second = std::numeric_limits<int32_t>::max();
+    int min_index = 0;
+    for (int j = 1; j < static_cast<int>(centers.size()); ++j) {
+        int32_t dist = squared_distance(pixel, centers[j]);
+        if (dist < nearest) {
+            second = nearest;
+            nearest = dist;
+            min_index = j;
+        }
+        else if (dist < second) {
+            second = dist;
+        }
+    }
+    return min_index;
+}
+
+//      
+inline double center_distance(const Center& a, const Center& b) {
+    int64_t dr = a.r - b.r;
+    int64_t dg = a.g - b.g;
+    int64_t db = a.b - b.b;
+    return std::sqrt(static_cast<double>(dr * dr + dg * dg + db * db));
+}
+
+//   k-means   ( )    
+struct ColorPlanes {
+    ScratchVector<uint8_t> r, g, b;
+};
+
+ColorPlanes make_color_planes(const ScratchVector<RGB>& colors) {
+    ColorPlanes planes;
+    planes.r.resize(colors.size());
+    planes.g.resize(colors.size());
+    planes.b.resize(colors.size());
+    for (size_t i = 0; i < colors.size(); ++i) {
+        planes.r[i] = colors[i].r;
+        planes.g[i] = colors[i].g;
+        planes.b[i] = colors[i].b;
+    }
+    return planes;
+}
+
+//      :    L1   
+constexpr size_t kAssignChunk = 1024;
+
+#ifdef CPU_X86
+// AVX2:    8   int32 -    ,    squared_distance
+TARGET_AVX2 inline __m256i squared_distance_avx2(__m256i r, __m256i g, __m256i b, __m256i cr, __m256i cg, __m256i cb) {
+    __m256i dr = _mm256_sub_epi32(r, cr);
+    __m256i dg = _mm256_sub_epi32(g, cg);
+    __m256i db = _mm256_sub_epi32(b, cb);
+    return _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dr, dr), _mm256_mullo_epi32(dg, dg)),
+        _mm256_mullo_epi32(db, db));
+}
+
+// AVX2: 8    int32   
+TARGET_AVX2 inline __m256i load_plane_avx2(const uint8_t* p) {
+    return _mm256_slli_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))),
+        kCenterFractionBits);
+}
+
+// AVX2: 16      . ,     
+//   ;           .
+TARGET_AVX2 void assign_chunk_avx2(const ColorPlanes& planes, size_t begin, size_t end,
+    const std::vector<Center>& centers, int32_t* labels, int32_t* nearest, int32_t* second) {
+    const int n_clusters = static_cast<int>(centers.size());
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16) {
+        __m256i r0 = load_plane_avx2(&planes.r[i]), r1 = load_plane_avx2(&planes.r[i + 8]);
+        __m256i g0 = load_plane_avx2(&planes.g[i]), g1 = load_plane_avx2(&planes.g[i + 8]);
+        __m256i b0 = load_plane_avx2(&planes.b[i]), b1 = load_plane_avx2(&planes.b[i + 8]);
+        __m256i min0 = _mm256_set1_epi32(std::numeric_limits<int32_t>::max()), min1 = min0;
+        __m256i second0 = min0, second1 = min0;
+        __m256i label0 = _mm256_setzero_si256(), label1 = label0;
+        for (int j = 0; j < n_clusters; ++j) {
+            __m256i cr = _mm256_set1_epi32(centers[j].r);
+            __m256i cg = _mm256_set1_epi32(centers[j].g);
+            __m256i cb = _mm256_set1_epi32(centers[j].b);
+            __m256i index = _mm256_set1_epi32(j);
+            __m256i d0 = squared_distance_avx2(r0, g0, b0, cr, cg, cb);
+            __m256i d1 = squared_distance_avx2(r1, g1, b1, cr, cg, cb);
+            second0 = _mm256_min_epi32(second0, _mm256_max_epi32(min0, d0));
+            second1 = _mm256_min_epi32(second1, _mm256_max_epi32(min1, d1));
+            label0 = _mm256_blendv_epi8(label0, index, _mm256_cmpgt_epi32(min0, d0));
+            label1 = _mm256_blendv_epi8(label1, index, _mm256_cmpgt_epi32(min1, d1));
+            min0 = _mm256_min_epi32(min0, d0);
+            min1 = _mm256_min_epi32(min1, d1);
+        }
+        size_t k = i - begin;
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + k), label0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(labels + k + 8), label1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(nearest + k), min0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(nearest + k + 8), min1);
+        if (second) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(second + k), second0);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(second + k + 8), second1);
+        }
+    }
+    for (; i < end; ++i) {
+        RGB color = { planes.r[i], planes.g[i], planes.b[i] };
+        int32_t second_dist;
+        labels[i - begin] = nearest_two_centers(color, centers, nearest[i - begin], second_dist);
+        if (second) {
+            second[i - begin] = second_dist;
+        }
+    }
+}
+#endif
+
+//        (second  nullptr -     )
+//   [begin, end);     .      .
+void assign_chunk(const ScratchVector<RGB>& colors, const ColorPlanes& planes, SimdLevel level, size_t begin, size_t end,
+    const std::vector<Center>& centers, int32_t* labels, int32_t* nearest, int32_t* second) {
+#ifdef CPU_X86
+    if (level == SimdLevel::AVX2) {
+        assign_chunk_avx2(planes, begin, end, centers, labels, nearest, second);
+        return;
+    }
+#endif
+    for (size_t i = begin; i < end; ++i) {
+        if (second) {
+            labels[i - begin] = nearest_two_centers(colors[i], centers, nearest[i - begin], second[i - begin]);
+        }
+        else {
+            labels[i - begin] = nearest_center(colors[i], centers, &nearest[i - begin]);
+        }
+    }
+}
+
+//       sqrt    double.    2^16,
+//    -  1e-11,        .
+constexpr double kBoundSlack = 1e-6;
+
+//   : colors[i]  weights[i]  (weights  -   1).
+// centers -   (. seed_centers),   - .
+//         ,     .
+//
+// KMeansAlgorithm::Hamerly             -
+//  .         ( ),
+//               ,
+//            .   
+//   ,           ,
+//        .
+//
+//      options (. KMeansOptions);     -
+//     ,         .
+KMeansStats lloyd(const ScratchVector<RGB>& colors, const ScratchVector<uint32_t>& weights, ScratchVector<int>& labels,
+    std::vector<Center>& centers, const KMeansOptions& options = KMeansOptions()) {
+    const int n_clusters = static_cast<int>(centers.size());
+    const bool bounded = options.algorithm == KMeansAlgorithm::Hamerly && n_clusters > 1;
+    labels.assign(colors.size(), 0);
+
+    const size_t blocks = (colors.size() + kLloydBlockSize - 1) / kLloydBlockSize;
+    ScratchVector<ClusterSum> partial(blocks * n_clusters);
+    std::vector<uint64_t> block_changed(blocks); //   ,  
+    std::vector<FarthestPoint> block_farthest(blocks);
+    std::vector<ClusterSum> total(n_clusters);
+
+    //  :  ,     ,
+    //           
+    ScratchVector<double> upper, lower;
+    std::vector<double> shift(n_clusters, 0.0), other_shift(n_clusters, 0.0), half_gap(n_clusters, 0.0);
+    bool bounds_ready = false;
+    if (bounded) {
+        upper.resize(colors.size());
+        lower.resize(colors.size());
+    }
+
+    //      
+    ColorPlanes planes;
+    if (options.simd != SimdLevel::Scalar) {
+        planes = make_color_planes(colors);
+    }
+
+    std::vector<Center> previous_centers;
+    uint64_t total_weight = weights.empty() ? colors.size() : 0;
+    for (uint32_t weight : weights) {
+        total_weight += weight;
+    }
+
+    auto accumulate = [&](ClusterSum* sums, size_t i, int label) {
+        int64_t weight = weights.empty() ? 1 : weights[i];
+        ClusterSum& sum = sums[label];
+        sum.r += weight * colors[i].r;
+        sum.g += weight * colors[i].g;
+        sum.b += weight * colors[i].b;
+        sum.count += weight;
+    };
+
+    //        
+    auto process_block = [&](int block) {
+        size_t begin = block * kLloydBlockSize;
+        size_t end = std::min(colors.size(), begin + kLloydBlockSize);
+        ClusterSum* sums = &partial[block * n_clusters];
+        std::fill(sums, sums + n_clusters, ClusterSum());
+        uint64_t changed = 0;
+        FarthestPoint farthest;
+        int32_t chunk_labels[kAssignChunk], chunk_nearest[kAssignChunk];
+        for (size_t chunk = begin; chunk < end; chunk += kAssignChunk) {
+            size_t chunk_end = std::min(end, chunk + kAssignChunk);
+            assign_chunk(colors, planes, options.simd, chunk, chunk_end, centers, chunk_labels, chunk_nearest, nullptr);
+            for (size_t i = chunk; i < chunk_end; ++i) {
+                int min_index = chunk_labels[i - chunk];
+                int32_t min_dist = chunk_nearest[i - chunk];
+                if (labels[i] != min_index) {
+                    labels[i] = min_index;
+                    changed += weights.empty() ? 1 : weights[i];
+                }
+                if (min_dist > farthest.distance) {
+                    farthest = { min_dist, i };
+                }
+                accumulate(sums, i, min_index);
             }
         }
+        block_changed[block] = changed;
+        block_farthest[block] = farthest;
+    };
 
-        //  2:   
-        std::fill(centers.begin(), centers.end(), RGB{ 0, 0, 0 });
-        std::fill(counts.begin(), counts.end(), 0);
+    //     ;       (. ).
+    //      ,       .
+    auto process_block_bounded = [&](int block) {
+        size_t begin = block * kLloydBlockSize;
+        size_t end = std::min(colors.size(), begin + kLloydBlockSize);
+        ClusterSum* sums = &partial[block * n_clusters];
+        std::fill(sums, sums + n_clusters, ClusterSum());
+        uint64_t changed = 0;
+        int32_t chunk_labels[kAssignChunk], chunk_nearest[kAssignChunk], chunk_second[kAssignChunk];
+        for (size_t i = begin; i < end; ++i) {
+            size_t chunk_offset = (i - begin) % kAssignChunk;
+            if (!bounds_ready && chunk_offset == 0) {
+                assign_chunk(colors, planes, options.simd, i, std::min(end, i + kAssignChunk), centers,
+                    chunk_labels, chunk_nearest, chunk_second);
+            }
+            int label = labels[i];
+            bool search = !bounds_ready;
+            if (!search) {
+                upper[i] += shift[label];
+                lower[i] -= other_shift[label];
+                double bound = std::max(half_gap[label], lower[i]);
+                if (upper[i] >= bound) {
+                    //         
+                    upper[i] = std::sqrt(static_cast<double>(squared_distance(colors[i], centers[label]))) + kBoundSlack;
+                    search = upper[i] >= bound;
+                }
+            }
+            if (search) {
+                int32_t nearest, second;
+                int min_index;
+                if (bounds_ready) {
+                    min_index = nearest_two_centers(colors[i], centers, nearest, second);
+                }
+                else {
+                    min_index = chunk_labels[chunk_offset];
+                    nearest = chunk_nearest[chunk_offset];
+                    second = chunk_second[chunk_offset];
+                }
+                upper[i] = std::sqrt(static_cast<double>(nearest)) + kBoundSlack;
+                lower[i] = std::sqrt(static_cast<double>(second)) - kBoundSlack;
+                if (label != min_index) {
+                    labels[i] = min_index;
+                    label = min_index;
+                    changed += weights.empty() ? 1 : weights[i];
+                }
+            }
+            accumulate(sums, i, label);
+        }
+        block_changed[block] = changed;
+    };
 
-        //       
-        std::vector<int> sum_r(n_clusters, 0);
-        std::vector<int> sum_g(n_clusters, 0);
-        std::vector<int> sum_b(n_clusters, 0);
+    KMeansStats stats;
+    for (int iteration = 1;; ++iteration) {
+        if (bounded) {
+            for (int j = 0; j < n_clusters; ++j) {
+                double gap = std::numeric_limits<double>::max();
+                for (int other = 0; other < n_clusters; ++other) {
+                    if (other != j) {
+                        gap = std::min(gap, center_distance(centers[j], centers[other]));
+                    }
+                }
+                half_gap[j] = gap / 2 - kBoundSlack;
+            }
+        }
 
-        //       
-        for (size_t i = 0; i < pixels.size(); ++i) {
-            int cluster_id = labels[i];
-            sum_r[cluster_id] += pixels[i].r;
-            sum_g[cluster_id] += pixels[i].g;
-            sum_b[cluster_id] += pixels[i].b;
-            counts[cluster_id]++;
+        //  1:        
+        //       
+        if (bounded) {
+            for_each_block(blocks, options.pool, process_block_bounded);
+            bounds_ready = true;
+        }
+        else {
+            for_each_block(blocks, options.pool, process_block);
+        }
+        uint64_t changed = 0;
+        for (uint64_t block_weight : block_changed) {
+            changed += block_weight;
+        }
+
+        //  2:      
+        std::fill(total.begin(), total.end(), ClusterSum());
+        FarthestPoint farthest;
+        for (size_t block = 0; block < blocks; ++block) {
+            for (int j = 0; j < n_clusters; ++j) {
+                const ClusterSum& sum = partial[block * n_clusters + j];
+                total[j].r += sum.r;
+                total[j].g += sum.g;
+                total[j].b += sum.b;
+                total[j].count += sum.count;
+            }
+            if (block_farthest[block].distance > farthest.distance) {
+                farthest = block_farthest[block];
+            }
+        }
+
+        bool has_empty = std::any_of(total.begin(), total.end(), [](const ClusterSum& sum) { return sum.count == 0; });
+        if (bounded && has_empty) {
+            //   ,       :
+            //  ,         
+            for_each_block(blocks, options.pool, [&](int block) {
+                size_t begin = block * kLloydBlockSize;
+                size_t end = std::min(colors.size(), begin + kLloydBlockSize);
+                FarthestPoint block_max;
+                for (size_t i = begin; i < end; ++i) {
+                    int32_t dist = squared_distance(colors[i], centers[labels[i]]);
+                    if (dist > block_max.distance) {
+                        block_max = { dist, i };
+                    }
+                }
+                block_farthest[block] = block_max;
+            });
+            for (size_t block = 0; block < blocks; ++block) {
+                if (block_farthest[block].distance > farthest.distance) {
+                    farthest = block_farthest[block];
+                }
+            }
         }
 
-        //   
+        //    (    )
+        previous_centers = centers;
+        bool reseeded = false;
         for (int j = 0; j < n_clusters; ++j) {
-            if (counts[j] > 0) {
-                centers[j].r = sum_r[j] / counts[j];
-                centers[j].g = sum_g[j] / counts[j];
-                centers[j].b = sum_b[j] / counts[j];
+            const ClusterSum& sum = total[j];
+            if (sum.count > 0) {
+                centers[j] = { center_mean(sum.r, sum.count), center_mean(sum.g, sum.count), center_mean(sum.b, sum.count) };
             }
-            else {
-                //   ,    
-                centers[j] = pixels[rand() % pixels.size()];
+            else if (farthest.distance > 0) {
+                //        (   ,
+                //        )
+                centers[j] = to_center(colors[farthest.index]);
+                farthest.distance = 0;
+                reseeded = true;
             }
         }
 
-    } while (changed);
-}
+        if (bounded) {
+            //        
+            for (int j = 0; j < n_clusters; ++j) {
+                shift[j] = center_distance(previous_centers[j], centers[j]) + kBoundSlack;
+            }
+            for (int j = 0; j < n_clusters; ++j) {
+                double max_shift = 0;
+                for (int other = 0; other < n_clusters; ++other) {
+                    if (other != j) {
+                        max_shift = std::max(max_shift, shift[other]);
+                    }
+                }
+                other_shift[j] = max_shift;
+            }
+        }
 
+        KMeansIteration step;
+        step.iteration = iteration;
+        step.changed = changed;
+        step.changed_fraction = total_weight > 0 ? static_cast<double>(changed) / total_weight : 0.0;
+        for (int j = 0; j < n_clusters; ++j) {
+            step.max_shift = std::max(step.max_shift,
+                center_distance(previous_centers[j], centers[j]) / (1 << kCenterFractionBits));
+        }
+        stats.iterations.push_back(step);
 
-// DFS   
-void dfs(int x, int y, int cluster_index, const std::vector<std::vector<int>>& clustered_pixels,
-    std::vector<std::vector<bool>>& visited, Component& component, int width, int height) {
-    std::vector<std::pair<int, int>> stack = { {x, y} };
+        // .         .
+        //        :     .
+        if (changed == 0 && !reseeded) {
+            stats.stop = KMeansStop::Converged;
+            break;
+        }
+        if (options.max_iterations > 0 && iteration >= options.max_iterations) {
+            stats.stop = KMeansStop::MaxIterations;
+            break;
+        }
+        if (!reseeded && options.tolerance > 0 && step.max_shift <= options.tolerance) {
+            stats.stop = KMeansStop::Tolerance;
+            break;
+        }
+        if (!reseeded && iteration > 1 && options.min_changed_fraction > 0
+            && step.changed_fraction <= options.min_changed_fraction) {
+            stats.stop = KMeansStop::ChangedFraction;
+            break;
+        }
+    }
+    return stats;
+}
 
-    while (!stack.empty()) {
-        auto [cx, cy] = stack.back();
-        stack.pop_back();
+//    [0, 1)   53  .
+// std::uniform_real_distribution  :       .
+inline double random_unit(std::mt19937_64& rng) {
+    return static_cast<double>(rng() >> 11) * (1.0 / 9007199254740992.0);
+}
 
-        if (cx < 0 || cy < 0 || cx >= width || cy >= height || visited[cy][cx] || clustered_pixels[cy][cx] != cluster_index) {
+//    ,  scores[i]; total -  scores.
+//     ,      .
+size_t sample_by_score(const ScratchVector<double>& scores, double total, std::mt19937_64& rng) {
+    double target = random_unit(rng) * total;
+    double sum = 0;
+    size_t last_positive = 0;
+    for (size_t i = 0; i < scores.size(); ++i) {
+        if (scores[i] <= 0) {
             continue;
         }
+        sum += scores[i];
+        last_positive = i;
+        if (target < sum) {
+            return i;
+        }
+    }
+    //   : target     
+    return last_positive;
+}
+
+//  k-means|| (Bahmani  .):  kParallelOversampling * k   
+constexpr int kParallelRounds = 5;
+constexpr double kParallelOversampling = 2.0;
+
+//               
+struct SeedDistances {
+    ScratchVector<int32_t> distance;
+    ScratchVector<double> score; // weight * distance
+    std::vector<double> block_total;
+
+    double total() const {
+        double sum = 0;
+        for (double value : block_total) {
+            sum += value;
+        }
+        return sum;
+    }
+};
+
+//    [first, centers.end())   (  )
+void update_seed_distances(const ScratchVector<RGB>& colors, const ScratchVector<uint32_t>& weights,
+    const std::vector<Center>& centers, size_t first, SeedDistances& seed, ThreadPool* pool) {
+    const size_t blocks = seed.block_total.size();
+    for_each_block(blocks, pool, [&](int block) {
+        size_t begin = block * kLloydBlockSize;
+        size_t end = std::min(colors.size(), begin + kLloydBlockSize);
+        double sum = 0;
+        for (size_t i = begin; i < end; ++i) {
+            int32_t dist = seed.distance[i];
+            for (size_t j = first; j < centers.size(); ++j) {
+                dist = std::min(dist, squared_distance(colors[i], centers[j]));
+            }
+            seed.distance[i] = dist;
+            seed.score[i] = static_cast<double>(weights[i]) * dist;
+            sum += seed.score[i];
+        }
+        seed.block_total[block] = sum;
+    });
+}
+
+//  k-means++:   -  ,   -  ,   
+//      .      ,    .
+std::vector<Center> seed_plus_plus(const ScratchVector<RGB>& colors, const ScratchVector<uint32_t>& weights,
+    int n_clusters, std::mt19937_64& rng, ThreadPool* pool) {
+    ScratchVector<double> weight_scores(weights.begin(), weights.end());
+    double total_weight = 0;
+    for (double weight : weight_scores) {
+        total_weight += weight;
+    }
+
+    SeedDistances seed;
+    seed.distance.assign(colors.size(), std::numeric_limits<int32_t>::max());
+    seed.score.resize(colors.size());
+    seed.block_total.resize((colors.size() + kLloydBlockSize - 1) / kLloydBlockSize);
+
+    std::vector<Center> centers;
+    centers.push_back(to_center(colors[sample_by_score(weight_scores, total_weight, rng)]));
+    while (static_cast<int>(centers.size()) < n_clusters) {
+        update_seed_distances(colors, weights, centers, centers.size() - 1, seed, pool);
+        double total = seed.total();
+        size_t index = total > 0 ? sample_by_score(seed.score, total, rng) : sample_by_score(weight_scores, total_weight, rng);
+        centers.push_back(to_center(colors[index]));
+    }
+    return centers;
+}
+
+// k-means||:  kParallelRounds         
+// min(1, l * weight * D^2 / ),     ( ,   )
+//   n_clusters  k-means++   .     ,
+//         ,       .
+std::vector<Center> seed_parallel(const ScratchVector<RGB>& colors, const ScratchVector<uint32_t>& weights,
+    int n_clusters, std::mt19937_64& rng, ThreadPool* pool) {
+    ScratchVector<double> weight_scores(weights.begin(), weights.end());
+    double total_weight = 0;
+    for (double weight : weight_scores) {
+        total_weight += weight;
+    }
+
+    const size_t blocks = (colors.size() + kLloydBlockSize - 1) / kLloydBlockSize;
+    SeedDistances seed;
+    seed.distance.assign(colors.size(), std::numeric_limits<int32_t>::max());
+    seed.score.resize(colors.size());
+    seed.block_total.resize(blocks);
+
+    std::vector<size_t> candidates;
+    std::vector<Center> candidate_centers;
+    candidates.push_back(sample_by_score(weight_scores, total_weight, rng));
+    candidate_centers.push_back(to_center(colors[candidates[0]]));
+    update_seed_distances(colors, weights, candidate_centers, 0, seed, pool);
+
+    const double oversampling = kParallelOversampling * n_clusters;
+    std::vector<std::vector<size_t>> block_samples(blocks);
+    for (int round = 0; round < kParallelRounds; ++round) {
+        double total = seed.total();
+        if (total <= 0) {
+            break;
+        }
+        const uint64_t round_seed = rng();
+        for_each_block(blocks, pool, [&](int block) {
+            std::mt19937_64 block_rng(round_seed ^ (static_cast<uint64_t>(block) * 0x9E3779B97F4A7C15ull));
+            size_t begin = block * kLloydBlockSize;
+            size_t end = std::min(colors.size(), begin + kLloydBlockSize);
+            block_samples[block].clear();
+            for (size_t i = begin; i < end; ++i) {
+                double probability = oversampling * seed.score[i] / total;
+                if (random_unit(block_rng) < probability) {
+                    block_samples[block].push_back(i);
+                }
+            }
+        });
+
+        size_t first = candidate_centers.size();
+        for (const auto& samples : block_samples) {
+            for (size_t index : samples) {
+                candidates.push_back(index);
+                candidate_centers.push_back(to_center(colors[index]));
+            }
+        }
+        update_seed_distances(colors, weights, candidate_centers, first, seed, pool);
+    }
+
+    //   -   ,    
+    ScratchVector<uint64_t> block_weights(blocks * candidates.size(), 0);
+    for_each_block(blocks, pool, [&](int block) {
+        size_t begin = block * kLloydBlockSize;
+        size_t end = std::min(colors.size(), begin + kLloydBlockSize);
+        for (size_t i = begin; i < end; ++i) {
+            block_weights[block * candidates.size() + nearest_center(colors[i], candidate_centers)] += weights[i];
+        }
+    });
+
+    //    (    ) 
+    ScratchVector<RGB> candidate_colors;
+    ScratchVector<uint32_t> candidate_weights;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        uint64_t weight = 0;
+        for (size_t block = 0; block < blocks; ++block) {
+            weight += block_weights[block * candidates.size() + c];
+        }
+        if (weight > 0) {
+            candidate_colors.push_back(colors[candidates[c]]);
+            candidate_weights.push_back(static_cast<uint32_t>(std::min<uint64_t>(weight, std::numeric_limits<uint32_t>::max())));
+        }
+    }
+
+    std::vector<Center> centers = seed_plus_plus(candidate_colors, candidate_weights, n_clusters, rng, nullptr);
+    ScratchVector<int> candidate_labels;
+    lloyd(candidate_colors, candidate_weights, candidate_labels, centers);
+    return centers;
+}
+
+//      
+std::vector<Center> seed_centers(const ScratchVector<RGB>& colors, const ScratchVector<uint32_t>& weights,
+    int n_clusters, KMeansSeeding seeding, std::mt19937_64& rng, ThreadPool* pool) {
+    if (seeding == KMeansSeeding::PlusPlus) {
+        return seed_plus_plus(colors, weights, n_clusters, rng, pool);
+    }
+    if (seeding == KMeansSeeding::Parallel) {
+        return seed_parallel(colors, weights, n_clusters, rng, pool);
+    }
+
+    ScratchVector<double> weight_scores(weights.begin(), weights.end());
+    double total_weight = 0;
+    for (double weight : weight_scores) {
+        total_weight += weight;
+    }
+    std::vector<Center> centers(n_clusters);
+    for (int i = 0; i < n_clusters; ++i) {
+        centers[i] = to_center(colors[sample_by_score(weight_scores, total_weight, rng)]);
+    }
+    return centers;
+}
+
+//  - k-means:     ( max_iterations  )
+//      ,    
+constexpr int kMiniBatchIterations = 100;
+constexpr size_t kMiniBatchSeedSamples = 1 << 16;
+
+//       (weights  - ):     .
+//      (    kmeans   ).
+class WeightedSampler {
+public:
+    WeightedSampler(size_t count, const ScratchVector<uint32_t>& weights) : count_(count) {
+        cumulative_.reserve(weights.size());
+        uint64_t sum = 0;
+        for (uint32_t weight : weights) {
+            sum += weight;
+            cumulative_.push_back(sum);
+        }
+    }
+
+    size_t operator()(std::mt19937_64& rng) const {
+        if (cumulative_.empty()) {
+            return std::min(static_cast<size_t>(random_unit(rng) * count_), count_ - 1);
+        }
+        uint64_t total = cumulative_.back();
+        uint64_t target = std::min(static_cast<uint64_t>(random_unit(rng) * total), total - 1);
+        return std::upper_bound(cumulative_.begin(), cumulative_.end(), target) - cumulative_.begin();
+    }
+
+private:
+    size_t count_;
+    ScratchVector<uint64_t> cumulative_;
+};
+
+// - k-means (Sculley, 2010):         
+//  options.mini_batch_size .    - 1 / ( ,    ),
+//        .      ;
+//       (. cluster_colors).
+//   changed  , max_shift -    .
+KMeansStats mini_batch(const ScratchVector<RGB>& colors, const ScratchVector<uint32_t>& weights,
+    std::vector<Center>& centers, const KMeansOptions& options, std::mt19937_64& rng) {
+    const int n_clusters = static_cast<int>(centers.size());
+    const int iterations = options.max_iterations > 0 ? options.max_iterations : kMiniBatchIterations;
+    const size_t batch_size = std::max(options.mini_batch_size, 1);
+    const double scale = 1 << kCenterFractionBits;
+    WeightedSampler sample(colors.size(), weights);
+
+    //   double,         
+    std::vector<double> position(3 * n_clusters);
+    for (int j = 0; j < n_clusters; ++j) {
+        position[3 * j] = centers[j].r / scale;
+        position[3 * j + 1] = centers[j].g / scale;
+        position[3 * j + 2] = centers[j].b / scale;
+    }
+    std::vector<double> previous;
+    std::vector<uint64_t> counts(n_clusters, 0);
+    std::vector<size_t> batch(batch_size);
+    std::vector<int> batch_labels(batch_size);
+
+    KMeansStats stats;
+    stats.stop = KMeansStop::MaxIterations;
+    for (int iteration = 1; iteration <= iterations; ++iteration) {
+        previous = position;
+
+        //        
+        for (size_t s = 0; s < batch_size; ++s) {
+            batch[s] = sample(rng);
+            batch_labels[s] = nearest_center(colors[batch[s]], centers);
+        }
+        for (size_t s = 0; s < batch_size; ++s) {
+            int j = batch_labels[s];
+            double rate = 1.0 / static_cast<double>(++counts[j]);
+            const RGB& color = colors[batch[s]];
+            position[3 * j] += rate * (color.r - position[3 * j]);
+            position[3 * j + 1] += rate * (color.g - position[3 * j + 1]);
+            position[3 * j + 2] += rate * (color.b - position[3 * j + 2]);
+        }
+
+        KMeansIteration step;
+        step.iteration = iteration;
+        for (int j = 0; j < n_clusters; ++j) {
+            centers[j] = { static_cast<int32_t>(std::lround(position[3 * j] * scale)),
+                static_cast<int32_t>(std::lround(position[3 * j + 1] * scale)),
+                static_cast<int32_t>(std::lround(position[3 * j + 2] * scale)) };
+            double dr = position[3 * j] - previous[3 * j];
+            double dg = position[3 * j + 1] - previous[3 * j + 1];
+            double db = position[3 * j + 2] - previous[3 * j + 2];
+            step.max_shift = std::max(step.max_shift, std::sqrt(dr * dr + dg * dg + db * db));
+        }
+        stats.iterations.push_back(step);
+
+        if (options.tolerance > 0 && step.max_shift <= options.tolerance) {
+            stats.stop = KMeansStop::Tolerance;
+            break;
+        }
+    }
+    return stats;
+}
+
+//      
+KMeansStats cluster_colors(const ScratchVector<RGB>& colors, const ScratchVector<uint32_t>& weights,
+    ScratchVector<int>& labels, std::vector<Center>& centers, const KMeansOptions& options, std::mt19937_64& rng) {
+    if (options.algorithm != KMeansAlgorithm::MiniBatch) {
+        return lloyd(colors, weights, labels, centers, options);
+    }
+
+    KMeansStats stats = mini_batch(colors, weights, centers, options, rng);
+    //   :        
+    KMeansOptions final_pass = options;
+    final_pass.algorithm = KMeansAlgorithm::Lloyd;
+    final_pass.max_iterations = 1;
+    KMeansStats pass = lloyd(colors, weights, labels, centers, final_pass);
+    KMeansIteration step = pass.iterations.back();
+    step.iteration = static_cast<int>(stats.iterations.size()) + 1;
+    //     ,      
+    step.changed = 0;
+    step.changed_fraction = 0;
+    stats.iterations.push_back(step);
+    return stats;
+}
+
+//  K-Means   .
+//           std::mt19937_64   options.seed,
+//  None  Exact   ,        .
+// -         ,    ,
+//       .
+KMeansStats kmeans(const ScratchVector<RGB>& pixels, ScratchVector<int>& labels, std::vector<RGB>& centers, int n_clusters,
+    const KMeansOptions& options = KMeansOptions()) {
+    //  :     ,         
+    if (pixels.empty()) {
+        labels.clear();
+        centers.assign(n_clusters, RGB());
+        return KMeansStats();
+    }
+
+    std::mt19937_64 rng(options.seed);
+
+    std::vector<Center> fine_centers;
+    KMeansStats stats;
+    if (options.histogram == ColorHistogram::None && options.algorithm == KMeansAlgorithm::MiniBatch) {
+        WeightedSampler sample(pixels.size(), {});
+        ScratchVector<RGB> seed_colors(std::min(pixels.size(), kMiniBatchSeedSamples));
+        for (auto& color : seed_colors) {
+            color = pixels[sample(rng)];
+        }
+        ScratchVector<uint32_t> seed_weights(seed_colors.size(), 1);
+        fine_centers = seed_centers(seed_colors, seed_weights, n_clusters, options.seeding, rng, options.pool);
+        stats = cluster_colors(pixels, {}, labels, fine_centers, options, rng);
+    }
+    else if (options.histogram == ColorHistogram::None) {
+        ColorPalette palette = build_exact_palette(pixels);
+        fine_centers = seed_centers(palette.colors, palette.weights, n_clusters, options.seeding, rng, options.pool);
+        stats = cluster_colors(pixels, {}, labels, fine_centers, options, rng);
+    }
+    else {
+        //    ,       pixel_to_color
+        ColorPalette palette = options.histogram == ColorHistogram::Exact
+            ? build_exact_palette(pixels) : build_quantized_palette(pixels, options.histogram_bits);
+        fine_centers = seed_centers(palette.colors, palette.weights, n_clusters, options.seeding, rng, options.pool);
+        ScratchVector<int> color_labels;
+        stats = cluster_colors(palette.colors, palette.weights, color_labels, fine_centers, options, rng);
+
+        labels.resize(pixels.size());
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            labels[i] = color_labels[palette.pixel_to_color[i]];
+        }
+    }
+
+    centers.resize(n_clusters);
+    for (int j = 0; j < n_clusters; ++j) {
+        centers[j] = to_rgb(fine_centers[j]);
+    }
+    return stats;
+}
+
+
+//     (     ).
+//      : uint8_t  254 ,  uint16_t;
+//    kBackground.
+template <typename Label>
+struct LabelImage {
+    static constexpr Label kBackground = std::numeric_limits<Label>::max();
+
+    int width = 0;
+    int height = 0;
+    ScratchVector<Label> labels;
+
+    Label at(int x, int y) const { return labels[static_cast<size_t>(y) * width + x]; }
+};
+
+//       
+template <typename Label>
+LabelImage<Label> build_label_image(const ScratchVector<int>& filtered_indices, const ScratchVector<int>& labels,
+    int width, int height) {
+    LabelImage<Label> image;
+    image.width = width;
+    image.height = height;
+    image.labels.assign(static_cast<size_t>(width) * height, LabelImage<Label>::kBackground);
+    for (size_t i = 0; i < filtered_indices.size(); ++i) {
+        image.labels[filtered_indices[i]] = static_cast<Label>(labels[i]);
+    }
+    return image;
+}
+
+//   
+struct ComponentInfo {
+    int cluster = 0;                           //  
+    int area = 0;                              //  
+    int min_x = 0, min_y = 0, max_x = 0, max_y = 0; //  
+    int anchor_x = 0, anchor_y = 0;            //      (,  )
+};
 
-        visited[cy][cx] = true;
-        component.pixels.push_back({ cx, cy });
+//    :     (-1  )   .
+//         .
+struct ComponentLabeling {
+    int width = 0;
+    int height = 0;
+    ScratchVector<int32_t> component_ids;
+    ScratchVector<ComponentInfo> components;
+};
 
-        //  
-        stack.push_back({ cx - 1, cy });
-        stack.push_back({ cx + 1, cy });
-        stack.push_back({ cx, cy - 1 });
-        stack.push_back({ cx, cy + 1 });
+//       (  )
+inline int32_t find_root(ScratchVector<int32_t>& parent, int32_t x) {
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
     }
+    return x;
 }
 
-//   
-std::vector<Component> find_connected_components(const std::vector<std::vector<int>>& clustered_pixels,
-    int cluster_index, int min_size, int width, int height) {
-    std::vector<std::vector<bool>> visited(height, std::vector<bool>(width, false));
-    std::vector<Component> components;
+//  ;    ,      
+inline void unite(ScratchVector<int32_t>& parent, int32_t a, int32_t b) {
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    }
+    else if (b < a) {
+        parent[a] = b;
+    }
+}
 
+//     (4-)    .
+//          union-find     ,
+//           .
+template <typename Label>
+ComponentLabeling label_components(const LabelImage<Label>& clustered_pixels) {
+    const int width = clustered_pixels.width;
+    const int height = clustered_pixels.height;
+    const ScratchVector<Label>& labels = clustered_pixels.labels;
+
+    ComponentLabeling result;
+    result.width = width;
+    result.height = height;
+    result.component_ids.resize(labels.size());
+    ScratchVector<int32_t>& ids = result.component_ids;
+    ScratchVector<int32_t> parent;
+
+    //  1:  
     for (int y = 0; y < height; ++y) {
         for (int x = 0; x < width; ++x) {
-            if (!visited[y][x] && clustered_pixels[y][x] == cluster_index) {
-                Component component;
-                dfs(x, y, cluster_index, clustered_pixels, visited, component, width, height);
-
-                if (component.pixels.size() >= min_size) {
-                    components.push_back(component);
+            size_t index = static_cast<size_t>(y) * width + x;
+            Label label = labels[index];
+            if (label == LabelImage<Label>::kBackground) {
+                ids[index] = -1;
+                continue;
+            }
+            bool left = x > 0 && labels[index - 1] == label;
+            bool up = y > 0 && labels[index - width] == label;
+            if (left) {
+                ids[index] = ids[index - 1];
+                if (up) {
+                    unite(parent, ids[index - 1], ids[index - width]);
                 }
             }
+            else if (up) {
+                ids[index] = ids[index - width];
+            }
+            else {
+                ids[index] = static_cast<int32_t>(parent.size());
+                parent.push_back(ids[index]);
+            }
         }
     }
 
-    return components;
+    //  2:    
+    ScratchVector<int32_t> final_ids(parent.size(), -1);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t index = static_cast<size_t>(y) * width + x;
+            if (ids[index] < 0) {
+                continue;
+            }
+            int32_t root = find_root(parent, ids[index]);
+            if (final_ids[root] < 0) {
+                final_ids[root] = static_cast<int32_t>(result.components.size());
+                ComponentInfo info;
+                info.cluster = labels[index];
+                info.min_x = info.max_x = info.anchor_x = x;
+                info.min_y = info.max_y = info.anchor_y = y;
+                result.components.push_back(info);
+            }
+            int32_t id = final_ids[root];
+            ids[index] = id;
+            ComponentInfo& info = result.components[id];
+            info.area++;
+            info.min_x = std::min(info.min_x, x);
+            info.max_x = std::max(info.max_x, x);
+            info.max_y = y;
+        }
+    }
+
+    return result;
 }
 
-//   ( ,  )
-std::vector<Component> sort_components(const std::vector<Component>& components) {
-    auto top_left = [](const Component& component) {
-        return *std::min_element(component.pixels.begin(), component.pixels.end(),
-            [](const std::pair<int, int>& a, const std::pair<int, int>& b) {
-                return std::tie(a.second, a.first) < std::tie(b.second, b.first);
-            });
-        };
+//    min_size ,   .
+//           .
+std::vector<std::vector<Component>> collect_components(const ComponentLabeling& labeling, int n_clusters, int min_size) {
+    std::vector<std::vector<Component>> clusters(n_clusters);
+    ScratchVector<Component*> targets(labeling.components.size(), nullptr);
 
-    std::vector<Component> sorted_components = components;
-    std::sort(sorted_components.begin(), sorted_components.end(),
-        [&](const Component& a, const Component& b) {
-            return top_left(a) < top_left(b);
-        });
+    //   ,        
+    for (const ComponentInfo& info : labeling.components) {
+        if (info.area >= min_size) {
+            clusters[info.cluster].emplace_back();
+        }
+    }
+    std::vector<size_t> next(n_clusters, 0);
+    for (size_t id = 0; id < labeling.components.size(); ++id) {
+        const ComponentInfo& info = labeling.components[id];
+        if (info.area >= min_size) {
+            Component* component = &clusters[info.cluster][next[info.cluster]++];
+            component->area = info.area;
+            component->min_x = info.min_x;
+            component->min_y = info.min_y;
+            component->max_x = info.max_x;
+            component->max_y = info.max_y;
+            component->top_left_x = info.anchor_x;
+            component->top_left_y = info.anchor_y;
+            targets[id] = component;
+        }
+    }
 
+    for (int y = 0; y < labeling.height; ++y) {
+        const int32_t* ids = &labeling.component_ids[static_cast<size_t>(y) * labeling.width];
+        int x = 0;
+        while (x < labeling.width) {
+            int32_t id = ids[x];
+            int x_begin = x;
+            while (x < labeling.width && ids[x] == id) {
+                ++x;
+            }
+            if (id >= 0 && targets[id]) {
+                targets[id]->runs.push_back({ y, x_begin, x });
+            }
+        }
+    }
+    return clusters;
+}
+
+//   ( ,  ).
+//  -   ,    ,   O(1).
+//    (, ),         .
+std::vector<Component> sort_components(std::vector<Component> components) {
+    struct SortKey {
+        int x, y;
+        size_t index;
+    };
+    std::vector<SortKey> keys(components.size());
+    for (size_t i = 0; i < components.size(); ++i) {
+        keys[i] = { components[i].top_left_x, components[i].top_left_y, i };
+    }
+    std::sort(keys.begin(), keys.end(), [](const SortKey& a, const SortKey& b) {
+        return std::tie(a.x, a.y) < std::tie(b.x, b.y);
+    });
+
+    std::vector<Component> sorted_components;
+    sorted_components.reserve(components.size());
+    for (const SortKey& key : keys) {
+        sorted_components.push_back(std::move(components[key.index]));
+    }
     return sorted_components;
 }
 
-//  
-std::vector<RGB> highlight_components(const std::vector<RGB>& image, const Component& component, int width, int height) {
-    std::vector<RGB> result(image.size(), { 255, 255, 255 }); //  
-    for (const auto& pixel : component.pixels) {
-        int idx = pixel.second * width + pixel.first;
-        result[idx] = image[idx];
+//  :       
+ScratchVector<RGB> highlight_components(const StbImage<RGB>& image, const Component& component, int width, int height) {
+    ScratchVector<RGB> result(image.size(), { 255, 255, 255 }); //  
+    for (const Run& run : component.runs) {
+        size_t idx = static_cast<size_t>(run.y) * width + run.x_begin;
+        std::copy(image.begin() + idx, image.begin() + idx + (run.x_end - run.x_begin), result.begin() + idx);
+    }
+    return result;
+}
+
+//    :     ,  
+ScratchVector<RGB> crop_component(const StbImage<RGB>& image, const Component& component, int width) {
+    const int crop_width = component.max_x - component.min_x + 1;
+    const int crop_height = component.max_y - component.min_y + 1;
+    ScratchVector<RGB> result(static_cast<size_t>(crop_width) * crop_height, { 255, 255, 255 });
+    for (const Run& run : component.runs) {
+        size_t src = static_cast<size_t>(run.y) * width + run.x_begin;
+        size_t dst = static_cast<size_t>(run.y - component.min_y) * crop_width + (run.x_begin - component.min_x);
+        std::copy(image.begin() + src, image.begin() + src + (run.x_end - run.x_begin), result.begin() + dst);
+    }
+    return result;
+}
+
+//     RGBA:  255     0  
+ScratchVector<unsigned char> crop_component_rgba(const StbImage<RGB>& image, const Component& component, int width) {
+    const int crop_width = component.max_x - component.min_x + 1;
+    const int crop_height = component.max_y - component.min_y + 1;
+    ScratchVector<unsigned char> result(static_cast<size_t>(crop_width) * crop_height * 4, 0);
+    for (const Run& run : component.runs) {
+        const RGB* src = &image[static_cast<size_t>(run.y) * width + run.x_begin];
+        unsigned char* dst = &result[(static_cast<size_t>(run.y - component.min_y) * crop_width + (run.x_begin - component.min_x)) * 4];
+        for (int x = run.x_begin; x < run.x_end; ++x, ++src, dst += 4) {
+            dst[0] = src->r;
+            dst[1] = src->g;
+            dst[2] = src->b;
+            dst[3] = 255;
+        }
     }
     return result;
 }
+
+//    :      (r + g * 256 + b * 65536),
+// 0 -       
+void save_label_index_image(const std::string& filename, const ScratchVector<uint32_t>& indices, int width, int height) {
+    ScratchVector<unsigned char> data(indices.size() * 3);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        data[i * 3] = static_cast<unsigned char>(indices[i]);
+        data[i * 3 + 1] = static_cast<unsigned char>(indices[i] >> 8);
+        data[i * 3 + 2] = static_cast<unsigned char>(indices[i] >> 16);
+    }
+    save_image_png(filename, data.data(), width, height, 3);
+}
+
 //   ,   
-std::vector<int> filter_background(const std::vector<RGB>& pixels, std::vector<RGB>& filtered_pixels) {
-    std::vector<int> indices;  //      
+ScratchVector<int> filter_background(const StbImage<RGB>& pixels, ScratchVector<RGB>& filtered_pixels) {
+    ScratchVector<int> indices;  //      
     for (size_t i = 0; i < pixels.size(); ++i) {
         const auto& pixel = pixels[i];
         // ,         ()
@@ -270,57 +1450,414 @@ std::vector<int> filter_background(const std::vector<RGB>& pixels, std::vector<R
     return indices;
 }
 
-//  
-void main_process(const std::string& image_path, int n_clusters = 5, int min_component_size = 100) {
-    int width, height;
-    std::vector<RGB> image = load_image(image_path, width, height);
+//   :
+// Full -       JPG,
+// Crop -      JPG,
+// FullPpm, CropPpm -     PPM   ( JPG   ),
+// CropAlpha -   PNG  - ,
+// LabelIndex -       PNG.
+//   ,  Full  FullPpm,       kComponentsMetadata.
+enum class ComponentOutput { Full, FullPpm, Crop, CropPpm, CropAlpha, LabelIndex };
 
-    std::cout << "   " << std::endl;
-    //   
-    std::vector<RGB> filtered_image;
-    std::vector<int> filtered_indices = filter_background(image, filtered_image);
-    std::cout << "  " << std::endl;
-    //   (   )
-    std::vector<int> labels;
-    std::vector<RGB> centers;
-    std::cout << "  " << std::endl;
-    kmeans(filtered_image, labels, centers, n_clusters);
-    std::cout << "  " << std::endl;
+const char* const kComponentsMetadata = "components.csv";
+const char* const kLabelIndexImage = "components_labels.png";
 
-    //         
-    std::vector<std::vector<int>> clustered_image(height, std::vector<int>(width, -1)); //   -1
+//   
+struct ComponentOutputOptions {
+    ComponentOutput format = ComponentOutput::Full;
+    AsyncEncoder* encoder = nullptr; //   ; nullptr -    
+    std::string directory;           //   ;  - 
+    bool verbose = true;             //     
+};
 
-    //     
-    for (size_t i = 0; i < filtered_indices.size(); ++i) {
-        int original_index = filtered_indices[i];
-        int row = original_index / width;
-        int col = original_index % width;
-        clustered_image[row][col] = labels[i];
+//      
+std::string output_path(const ComponentOutputOptions& options, const std::string& filename) {
+    return options.directory.empty() ? filename : (std::filesystem::path(options.directory) / filename).string();
+}
+
+//  :   ,   ,     
+void encode_image(AsyncEncoder* encoder, std::function<void()> task) {
+    if (encoder) {
+        encoder->submit(std::move(task));
     }
+    else {
+        task();
+    }
+}
+
+// ,      .
+//      ,      output_options.encoder ( );
+//     .
+template <typename Label>
+void process_clusters(const StbImage<RGB>& image, const LabelImage<Label>& clustered_image,
+    const std::vector<RGB>& centers, int n_clusters, int min_component_size,
+    const ComponentOutputOptions& output_options = ComponentOutputOptions()) {
+    const ComponentOutput output = output_options.format;
+    AsyncEncoder* const encoder = output_options.encoder;
+    const int width = clustered_image.width;
+    const int height = clustered_image.height;
+
+    std::ofstream metadata;
+    if (output != ComponentOutput::Full && output != ComponentOutput::FullPpm) {
+        metadata.open(output_path(output_options, kComponentsMetadata));
+        metadata << "index,file,cluster,component,x,y,width,height,area" << std::endl;
+    }
+    ScratchVector<uint32_t> label_index;
+    if (output == ComponentOutput::LabelIndex) {
+        label_index.assign(image.size(), 0);
+    }
+    uint32_t index = 0; //    ( 1)
+
+    //       
+    std::vector<std::vector<Component>> cluster_components =
+        collect_components(label_components(clustered_image), n_clusters, min_component_size);
 
     //   
     for (int i = 0; i < n_clusters; ++i) {
-        std::cout << "    " << i + 1 << "   ["
-            << (int)centers[i].r << ", " << (int)centers[i].g << ", " << (int)centers[i].b << "]:" << std::endl;
+        if (output_options.verbose) {
+            std::cout << "    " << i + 1 << "   ["
+                << (int)centers[i].r << ", " << (int)centers[i].g << ", " << (int)centers[i].b << "]:" << std::endl;
+        }
 
-        //    
-        std::vector<Component> components = find_connected_components(clustered_image, i, min_component_size, width, height);
-        std::vector<Component> sorted_components = sort_components(components);
+        //  
+        std::vector<Component> sorted_components = sort_components(std::move(cluster_components[i]));
 
         //     
         for (size_t j = 0; j < sorted_components.size(); ++j) {
-            std::vector<RGB> highlighted = highlight_components(image, sorted_components[j], width, height);
-            std::string filename = "cluster_" + std::to_string(i + 1) + "_component_" + std::to_string(j + 1) + ".jpg";
-            save_image_jpg(filename, highlighted, width, height);
-            std::cout << " : " << filename << std::endl;
+            const Component& component = sorted_components[j];
+            const int crop_width = component.max_x - component.min_x + 1;
+            const int crop_height = component.max_y - component.min_y + 1;
+            std::string filename = "cluster_" + std::to_string(i + 1) + "_component_" + std::to_string(j + 1);
+            ++index;
+
+            switch (output) {
+            case ComponentOutput::Full:
+            case ComponentOutput::FullPpm: {
+                const bool ppm = output == ComponentOutput::FullPpm;
+                filename += ppm ? ".ppm" : ".jpg";
+                encode_image(encoder, [path = output_path(output_options, filename), width, height, ppm,
+                    highlighted = highlight_components(image, component, width, height)] {
+                    (ppm ? save_image_ppm : save_image_jpg)(path, highlighted.data(), width, height);
+                });
+                break;
+            }
+            case ComponentOutput::Crop:
+            case ComponentOutput::CropPpm: {
+                const bool ppm = output == ComponentOutput::CropPpm;
+                filename += ppm ? ".ppm" : ".jpg";
+                encode_image(encoder, [path = output_path(output_options, filename), crop_width, crop_height, ppm,
+                    cropped = crop_component(image, component, width)] {
+                    (ppm ? save_image_ppm : save_image_jpg)(path, cropped.data(), crop_width, crop_height);
+                });
+                break;
+            }
+            case ComponentOutput::CropAlpha:
+                filename += ".png";
+                encode_image(encoder, [path = output_path(output_options, filename), crop_width, crop_height,
+                    cropped = crop_component_rgba(image, component, width)] {
+                    save_image_png(path, cropped.data(), crop_width, crop_height, 4);
+                });
+                break;
+            case ComponentOutput::LabelIndex:
+                filename = kLabelIndexImage;
+                for (const Run& run : component.runs) {
+                    size_t row = static_cast<size_t>(run.y) * width;
+                    std::fill(label_index.begin() + row + run.x_begin, label_index.begin() + row + run.x_end, index);
+                }
+                break;
+            }
+
+            if (metadata.is_open()) {
+                metadata << index << "," << filename << "," << i + 1 << "," << j + 1 << ","
+                    << component.min_x << "," << component.min_y << "," << crop_width << "," << crop_height << ","
+                    << component.area << std::endl;
+            }
+            if (output != ComponentOutput::LabelIndex && output_options.verbose) {
+                std::cout << " : " << filename << std::endl;
+            }
+        }
+    }
+
+    if (output == ComponentOutput::LabelIndex) {
+        save_label_index_image(output_path(output_options, kLabelIndexImage), label_index, width, height);
+        if (output_options.verbose) {
+            std::cout << " : " << kLabelIndexImage << std::endl;
+        }
+    }
+}
+
+//   :  ,    .
+//  false,        ( ).
+bool segment_image(const StbImage<RGB>& image, int n_clusters, int min_component_size,
+    const KMeansOptions& kmeans_options, const ComponentOutputOptions& output_options) {
+    const int width = image.width();
+    const int height = image.height();
+    auto log = [&](const char* message) {
+        if (output_options.verbose) {
+            std::cout << message << std::endl;
         }
+    };
+
+    log("   ");
+    //   
+    ScratchVector<RGB> filtered_image;
+    ScratchVector<int> filtered_indices = filter_background(image, filtered_image);
+    log("  ");
+    if (filtered_image.empty()) {
+        return false;
+    }
+    //   (   )
+    ScratchVector<int> labels;
+    std::vector<RGB> centers;
+    log("  ");
+    KMeansStats kmeans_stats = kmeans(filtered_image, labels, centers, n_clusters, kmeans_options);
+    log("  ");
+    if (output_options.verbose && !kmeans_stats.iterations.empty()) {
+        const KMeansIteration& last = kmeans_stats.iterations.back();
+        std::cout << " k-means: " << last.iteration << " (" << stop_reason(kmeans_stats.stop)
+            << "),  : " << last.changed << ",  : " << last.max_shift << std::endl;
     }
+
+    //     ;      
+    if (n_clusters < std::numeric_limits<uint8_t>::max()) {
+        process_clusters(image, build_label_image<uint8_t>(filtered_indices, labels, width, height),
+            centers, n_clusters, min_component_size, output_options);
+    }
+    else {
+        process_clusters(image, build_label_image<uint16_t>(filtered_indices, labels, width, height),
+            centers, n_clusters, min_component_size, output_options);
+    }
+    return true;
+}
+
+//  ;     , false -      
+bool main_process(const std::string& image_path, int n_clusters = 5, int min_component_size = 100,
+    const KMeansOptions& kmeans_options = KMeansOptions(),
+    const ComponentOutputOptions& output_options = ComponentOutputOptions()) {
+    int width, height;
+    StbImage<RGB> image = load_image(image_path, width, height);
+    if (!segment_image(image, n_clusters, min_component_size, kmeans_options, output_options)) {
+        std::cerr << ":   " << image_path << "    " << std::endl;
+        return false;
+    }
+    if (output_options.encoder) {
+        output_options.encoder->wait();
+    }
+    return true;
+}
+
+//      -:   
+//     out_dir (. batch_output_names). ,     .
+//    compute_threads  .    
+//     kmeans_options.seed,       .
+int run_batch(const std::string& batch_path, const std::string& out_dir, int n_clusters, int min_component_size,
+    const KMeansOptions& kmeans_options, const ComponentOutputOptions& output_options, int compute_threads) {
+    std::vector<std::string> inputs = collect_batch_inputs(batch_path);
+    if (inputs.empty()) {
+        std::cerr << ":    " << batch_path << std::endl;
+        return 1;
+    }
+    size_t renamed = 0;
+    const std::vector<std::string> output_names = batch_output_names(inputs, &renamed);
+    if (renamed > 0) {
+        std::cerr << ":  " << renamed << "    , "
+            << "      " << std::endl;
+    }
+
+    BatchOptions batch_options;
+    batch_options.compute_threads = std::max(compute_threads, 1);
+    BatchStats stats = run_batch_pipeline<StbImage<RGB>>(inputs,
+        [](const std::string& path, StbImage<RGB>& image) {
+            image = StbImage<RGB>::load(path);
+            if (image.empty()) {
+                std::cerr << ":     " << path << std::endl;
+                return false;
+            }
+            return true;
+        },
+        [&](size_t index, StbImage<RGB>& image) {
+            ComponentOutputOptions image_output = output_options;
+            image_output.directory = (std::filesystem::path(out_dir) / output_names[index]).string();
+            image_output.verbose = false;
+            std::error_code error;
+            std::filesystem::create_directories(image_output.directory, error);
+            if (error) {
+                std::cerr << ":     " << image_output.directory << std::endl;
+                return false;
+            }
+            if (!segment_image(image, n_clusters, min_component_size, kmeans_options, image_output)) {
+                std::cerr << ":   " << inputs[index] << "    " << std::endl;
+                std::filesystem::remove(image_output.directory, error);
+                return false;
+            }
+            std::cout << " : " << inputs[index] << std::endl;
+            return true;
+        },
+        *output_options.encoder, batch_options);
+
+    std::cout << " " << stats.processed << "  " << inputs.size() << "   "
+        << stats.seconds << "  (" << stats.images_per_second() << " /)" << std::endl;
+    return stats.failed == 0 ? 0 : 1;
 }
 
 
-int main() {
+//      
+void print_usage(const char* program) {
+    std::cerr << ": " << program << " [] [--histogram none|exact|quantized] [--histogram-bits 5|6]"
+        << " [--seeding random|kmeans++|kmeans||] [--seed N] [--algorithm lloyd|hamerly|minibatch]"
+        << " [--mini-batch N] [--max-iterations N] [--tolerance T] [--min-changed F]"
+        << " [--threads N] [--encoders N] [--output full|full-ppm|crop|crop-ppm|crop-alpha|labels]"
+        << " [--batch | [--out-dir ]]"
+        << std::endl;
+}
+
+int main(int argc, char* argv[]) {
     setlocale(LC_ALL, "Russian");
+
+    std::string image_path = "example2.jpg";
+    KMeansOptions options;
+    int threads = 1; // 0 -   
+    int encoders = 0; //   , 0 -   
+    ComponentOutput output = ComponentOutput::Full;
+    std::string batch_path;
+    std::string out_dir = ".";
+    //      ,     ,   
+    options.histogram = ColorHistogram::Exact;
+
+    //    
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--histogram" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "none") {
+                options.histogram = ColorHistogram::None;
+            }
+            else if (mode == "exact") {
+                options.histogram = ColorHistogram::Exact;
+            }
+            else if (mode == "quantized") {
+                options.histogram = ColorHistogram::Quantized;
+            }
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--histogram-bits" && i + 1 < argc) {
+            options.histogram_bits = std::atoi(argv[++i]);
+        }
+        else if (arg == "--seeding" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "random") {
+                options.seeding = KMeansSeeding::Random;
+            }
+            else if (mode == "kmeans++") {
+                options.seeding = KMeansSeeding::PlusPlus;
+            }
+            else if (mode == "kmeans||") {
+                options.seeding = KMeansSeeding::Parallel;
+            }
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--algorithm" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "lloyd") {
+                options.algorithm = KMeansAlgorithm::Lloyd;
+            }
+            else if (mode == "hamerly") {
+                options.algorithm = KMeansAlgorithm::Hamerly;
+            }
+            else if (mode == "minibatch") {
+                options.algorithm = KMeansAlgorithm::MiniBatch;
+            }
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--mini-batch" && i + 1 < argc) {
+            options.mini_batch_size = std::atoi(argv[++i]);
+        }
+        else if (arg == "--max-iterations" && i + 1 < argc) {
+            options.max_iterations = std::atoi(argv[++i]);
+        }
+        else if (arg == "--tolerance" && i + 1 < argc) {
+            options.tolerance = std::atof(argv[++i]);
+        }
+        else if (arg == "--min-changed" && i + 1 < argc) {
+            options.min_changed_fraction = std::atof(argv[++i]);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        }
+        else if (arg == "--encoders" && i + 1 < argc) {
+            encoders = std::atoi(argv[++i]);
+        }
+        else if (arg == "--batch" && i + 1 < argc) {
+            batch_path = argv[++i];
+        }
+        else if (arg == "--out-dir" && i + 1 < argc) {
+            out_dir = argv[++i];
+        }
+        else if (arg == "--output" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "full") {
+                output = ComponentOutput::Full;
+            }
+            else if (mode == "full-ppm") {
+                output = ComponentOutput::FullPpm;
+            }
+            else if (mode == "crop") {
+                output = ComponentOutput::Crop;
+            }
+            else if (mode == "crop-ppm") {
+                output = ComponentOutput::CropPpm;
+            }
+            else if (mode == "crop-alpha") {
+                output = ComponentOutput::CropAlpha;
+            }
+            else if (mode == "labels") {
+                output = ComponentOutput::LabelIndex;
+            }
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!arg.empty() && arg[0] != '-') {
+            image_path = arg;
+        }
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    AsyncEncoder encoder(static_cast<unsigned>(std::max(encoders, 0)));
+    ComponentOutputOptions output_options;
+    output_options.format = output;
+    output_options.encoder = &encoder;
+
+    if (!batch_path.empty()) {
+        //       ,    
+        if (threads <= 0) {
+            threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        }
+        return run_batch(batch_path, out_dir, 7, 500, options, output_options, threads);
+    }
+
+    std::unique_ptr<ThreadPool> pool;
+    if (threads != 1) {
+        pool = std::make_unique<ThreadPool>(static_cast<unsigned>(std::max(threads, 0)));
+        options.pool = pool.get();
+    }
+
     std::cout << "   " << std::endl;
-    main_process("example2.jpg", 7, 500);
-    return 0;
+    return main_process(image_path, 7, 500, options, output_options) ? 0 : 1;
 }
@@ -0,0 +1,117 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Файл, отображённый в память целиком. Отображение закрытое (copy-on-write): страницы берутся прямо
+// из кэша файловой системы и копируются только при записи, сам файл не изменяется.
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& path) { open(path); }
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // false - файл не открыт, пуст или не может быть отображён
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        // Последовательное чтение - подсказка упреждающему чтению кэша
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping) {
+            return false;
+        }
+        // Представление удерживает отображение, поэтому дескрипторы можно закрыть сразу
+        void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!view) {
+            return false;
+        }
+        data_ = static_cast<unsigned char*>(view);
+        size_ = static_cast<size_t>(file_size.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        const size_t file_size = static_cast<size_t>(st.st_size);
+        // Отображение создаётся только для чтения: MAP_POPULATE заранее подгружает страницы, а при записи
+        // в закрытое отображение он скопировал бы их все. Запись разрешается после подгрузки через mprotect,
+        // и тогда копируются только реально изменённые страницы.
+        int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        void* view = mmap(nullptr, file_size, PROT_READ, flags, fd, 0);
+        ::close(fd);
+        if (view == MAP_FAILED) {
+            return false;
+        }
+        madvise(view, file_size, MADV_SEQUENTIAL);
+#ifndef MAP_POPULATE
+        madvise(view, file_size, MADV_WILLNEED);
+#endif
+        if (mprotect(view, file_size, PROT_READ | PROT_WRITE) != 0) {
+            munmap(view, file_size);
+            return false;
+        }
+        data_ = static_cast<unsigned char*>(view);
+        size_ = file_size;
+#endif
+        return true;
+    }
+
+    void close() {
+        if (!data_) {
+            return;
+        }
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+#else
+        munmap(data_, size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    bool is_open() const { return data_ != nullptr; }
+    unsigned char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+};
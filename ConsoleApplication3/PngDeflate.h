@@ -0,0 +1,300 @@
+﻿#pragma once
+
+#include "ScratchArena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Компрессор zlib для stb_image_write (подключается через STBIW_ZLIB_COMPRESS).
+// Уровень сжатия (stbi_write_png_compression_level) выбирает режим:
+// 0 - без сжатия (stored-блоки), 1 - RLE (повторы только предыдущего байта, выгодно для почти чёрных
+// изображений Собеля), 2 и выше - жадный LZ77 по хеш-цепочкам глубиной 4 * уровень.
+// Все сжатые режимы используют фиксированные коды Хаффмана, как и встроенный компрессор stb.
+
+// Внешний компрессор с интерфейсом STBIW_ZLIB_COMPRESS; результат освобождается через STBIW_FREE
+// (free(), если STBIW_FREE не переопределён)
+using PngZlibCompressor = unsigned char* (*)(unsigned char* data, int data_len, int* out_len, int quality);
+
+// Установленный внешний компрессор (например, zlib или libdeflate) заменяет встроенные режимы
+inline PngZlibCompressor& png_zlib_compressor() {
+    static PngZlibCompressor compressor = nullptr;
+    return compressor;
+}
+
+namespace png_deflate_detail {
+
+const int kMaxMatch = 258;
+const int kMinMatch = 3;
+const int kWindowSize = 32768;
+const int kHashBits = 15;
+
+// Запись битового потока deflate (младшие биты первыми)
+class BitWriter {
+public:
+    explicit BitWriter(ScratchVector<unsigned char>& out) : out_(out) {}
+
+    void put(uint32_t bits, int count) {
+        buffer_ |= static_cast<uint64_t>(bits) << count_;
+        count_ += count;
+        while (count_ >= 8) {
+            out_.push_back(static_cast<unsigned char>(buffer_));
+            buffer_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    void flush() {
+        if (count_ > 0) {
+            put(0, 8 - count_);
+        }
+    }
+
+private:
+    ScratchVector<unsigned char>& out_;
+    uint64_t buffer_ = 0;
+    int count_ = 0;
+};
+
+// Фиксированные коды Хаффмана (RFC 1951, 3.2.6), уже развёрнутые для записи младшими битами вперёд
+struct FixedCodes {
+    uint16_t literal_code[288];
+    uint8_t literal_bits[288];
+    // Для длин 3..258: символ, число и значение дополнительных битов
+    uint16_t length_symbol[kMaxMatch + 1];
+    uint8_t length_extra_bits[kMaxMatch + 1];
+    uint16_t length_extra[kMaxMatch + 1];
+
+    FixedCodes() {
+        for (int n = 0; n < 288; ++n) {
+            int code, bits;
+            if (n <= 143) { code = 0x30 + n; bits = 8; }
+            else if (n <= 255) { code = 0x190 + n - 144; bits = 9; }
+            else if (n <= 279) { code = n - 256; bits = 7; }
+            else { code = 0xC0 + n - 280; bits = 8; }
+            literal_code[n] = static_cast<uint16_t>(reverse(code, bits));
+            literal_bits[n] = static_cast<uint8_t>(bits);
+        }
+        static const uint16_t base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t extra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        for (int i = 0; i < 29; ++i) {
+            int last = i + 1 < 29 ? base[i + 1] - 1 : kMaxMatch;
+            if (i == 27) {
+                last = 257; // 258 кодируется отдельным символом 285
+            }
+            for (int length = base[i]; length <= last; ++length) {
+                length_symbol[length] = static_cast<uint16_t>(257 + i);
+                length_extra_bits[length] = extra[i];
+                length_extra[length] = static_cast<uint16_t>(length - base[i]);
+            }
+        }
+    }
+
+    static int reverse(int code, int bits) {
+        int result = 0;
+        for (int i = 0; i < bits; ++i) {
+            result = (result << 1) | ((code >> i) & 1);
+        }
+        return result;
+    }
+};
+
+inline const FixedCodes& fixed_codes() {
+    static const FixedCodes codes;
+    return codes;
+}
+
+inline void put_literal(BitWriter& bits, const FixedCodes& codes, int symbol) {
+    bits.put(codes.literal_code[symbol], codes.literal_bits[symbol]);
+}
+
+inline void put_match(BitWriter& bits, const FixedCodes& codes, int length, int distance) {
+    put_literal(bits, codes, codes.length_symbol[length]);
+    if (codes.length_extra_bits[length]) {
+        bits.put(codes.length_extra[length], codes.length_extra_bits[length]);
+    }
+    // Код расстояния: 0-3 без дополнительных битов, далее по два кода на каждую степень двойки
+    int d = distance - 1;
+    int code, extra_bits;
+    if (d < 4) {
+        code = d;
+        extra_bits = 0;
+    }
+    else {
+        int top = 31;
+        while (!(d >> top)) {
+            --top;
+        }
+        extra_bits = top - 1;
+        code = 2 * top + ((d >> extra_bits) & 1);
+    }
+    bits.put(static_cast<uint32_t>(FixedCodes::reverse(code, 5)), 5);
+    if (extra_bits) {
+        bits.put(static_cast<uint32_t>(d & ((1 << extra_bits) - 1)), extra_bits);
+    }
+}
+
+inline int match_length(const unsigned char* a, const unsigned char* b, int limit) {
+    int length = 0;
+    while (length < limit && a[length] == b[length]) {
+        ++length;
+    }
+    return length;
+}
+
+// RLE: совпадения только с расстоянием 1
+inline void compress_rle(const unsigned char* data, int size, BitWriter& bits) {
+    const FixedCodes& codes = fixed_codes();
+    int i = 0;
+    while (i < size) {
+        if (i > 0) {
+            int length = match_length(data + i - 1, data + i, std::min(kMaxMatch, size - i));
+            if (length >= kMinMatch) {
+                put_match(bits, codes, length, 1);
+                i += length;
+                continue;
+            }
+        }
+        put_literal(bits, codes, data[i++]);
+    }
+}
+
+// Жадный LZ77: head - последняя позиция с данным хешем, prev - предыдущая позиция с тем же хешем
+inline void compress_greedy(const unsigned char* data, int size, int max_chain, BitWriter& bits) {
+    const FixedCodes& codes = fixed_codes();
+    ScratchVector<int32_t> head(1 << kHashBits, -1);
+    ScratchVector<int32_t> prev(kWindowSize, -1);
+    auto hash = [data](int i) {
+        uint32_t value = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+        return (value * 2654435761u) >> (32 - kHashBits);
+    };
+    auto insert = [&](int i) {
+        uint32_t h = hash(i);
+        prev[i & (kWindowSize - 1)] = head[h];
+        head[h] = i;
+    };
+
+    int i = 0;
+    while (i < size) {
+        int best_length = 0, best_distance = 0;
+        if (i + kMinMatch <= size) {
+            const int limit = std::min(kMaxMatch, size - i);
+            int candidate = head[hash(i)];
+            for (int chain = 0; candidate >= 0 && chain < max_chain; ++chain) {
+                int distance = i - candidate;
+                if (distance > kWindowSize) {
+                    break;
+                }
+                if (data[candidate + best_length] == data[i + best_length]) {
+                    int length = match_length(data + candidate, data + i, limit);
+                    if (length > best_length) {
+                        best_length = length;
+                        best_distance = distance;
+                        if (length == limit) {
+                            break;
+                        }
+                    }
+                }
+                candidate = prev[candidate & (kWindowSize - 1)];
+            }
+            insert(i);
+        }
+        if (best_length >= kMinMatch) {
+            put_match(bits, codes, best_length, best_distance);
+            for (int k = 1; k < best_length; ++k) {
+                if (i + k + kMinMatch <= size) {
+                    insert(i + k);
+                }
+            }
+            i += best_length;
+        }
+        else {
+            put_literal(bits, codes, data[i++]);
+        }
+    }
+}
+
+inline void put_stored(const unsigned char* data, int size, ScratchVector<unsigned char>& out) {
+    int offset = 0;
+    do {
+        int block = std::min(size - offset, 65535);
+        out.push_back(offset + block == size ? 1 : 0); // BFINAL, BTYPE = 0
+        out.push_back(static_cast<unsigned char>(block));
+        out.push_back(static_cast<unsigned char>(block >> 8));
+        out.push_back(static_cast<unsigned char>(~block));
+        out.push_back(static_cast<unsigned char>(~block >> 8));
+        out.insert(out.end(), data + offset, data + offset + block);
+        offset += block;
+    } while (offset < size);
+}
+
+inline uint32_t adler32(const unsigned char* data, int size) {
+    uint32_t s1 = 1, s2 = 0;
+    while (size > 0) {
+        int block = std::min(size, 5552); // наибольший блок без переполнения s2
+        for (int i = 0; i < block; ++i) {
+            s1 += data[i];
+            s2 += s1;
+        }
+        s1 %= 65521;
+        s2 %= 65521;
+        data += block;
+        size -= block;
+    }
+    return (s2 << 16) | s1;
+}
+
+} // namespace png_deflate_detail
+
+// Сжатие в формат zlib; сигнатура STBIW_ZLIB_COMPRESS, результат выделен STBIW_MALLOC
+// (заголовок подключается после переопределения STBIW_MALLOC, если оно есть) или malloc
+inline unsigned char* png_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality) {
+    using namespace png_deflate_detail;
+    if (PngZlibCompressor compressor = png_zlib_compressor()) {
+        return compressor(data, data_len, out_len, quality);
+    }
+
+    ScratchVector<unsigned char> out;
+    out.reserve(static_cast<size_t>(data_len) / 4 + 64);
+    out.push_back(0x78); // deflate, окно 32K
+    out.push_back(0x01); // проверочные биты заголовка, уровень "быстрый"
+    if (quality > 0) {
+        BitWriter bits(out);
+        bits.put(1, 1); // BFINAL
+        bits.put(1, 2); // BTYPE = 1, фиксированные коды
+        if (quality == 1) {
+            compress_rle(data, data_len, bits);
+        }
+        else {
+            compress_greedy(data, data_len, 4 * quality, bits);
+        }
+        put_literal(bits, fixed_codes(), 256); // конец блока
+        bits.flush();
+    }
+    // Несжимаемые данные (и уровень 0) пишутся как есть
+    const size_t stored_size = 2 + static_cast<size_t>(data_len) + 5 * (data_len / 65535 + 1);
+    if (quality <= 0 || out.size() > stored_size) {
+        out.resize(2);
+        put_stored(data, data_len, out);
+    }
+    uint32_t adler = adler32(data, data_len);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<unsigned char>(adler >> shift));
+    }
+
+#ifdef STBIW_MALLOC
+    unsigned char* result = static_cast<unsigned char*>(STBIW_MALLOC(out.size()));
+#else
+    unsigned char* result = static_cast<unsigned char*>(std::malloc(out.size()));
+#endif
+    if (!result) {
+        return nullptr;
+    }
+    std::memcpy(result, out.data(), out.size());
+    *out_len = static_cast<int>(out.size());
+    return result;
+}
@@ -0,0 +1,197 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+// Заголовок бинарного PNM: P5 (градации серого) или P6 (RGB)
+struct PnmHeader {
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int maxval = 0;
+    size_t data_offset = 0; // начало пиксельных данных от начала файла
+};
+
+namespace pnm_detail {
+
+inline bool is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Чтение десятичного числа заголовка с пропуском пробелов и комментариев (# до конца строки)
+inline bool read_number(const unsigned char* data, size_t size, size_t& pos, int& value) {
+    while (pos < size && (is_space(data[pos]) || data[pos] == '#')) {
+        if (data[pos] == '#') {
+            while (pos < size && data[pos] != '\n') {
+                ++pos;
+            }
+        }
+        else {
+            ++pos;
+        }
+    }
+    if (pos >= size || data[pos] < '0' || data[pos] > '9') {
+        return false;
+    }
+    int64_t result = 0;
+    while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+        result = result * 10 + (data[pos++] - '0');
+        if (result > INT32_MAX) {
+            return false;
+        }
+    }
+    value = static_cast<int>(result);
+    return true;
+}
+
+// Непрерывный фрагмент записываемых данных
+struct Chunk {
+    const unsigned char* data;
+    size_t size;
+};
+
+// Запись фрагментов в файл подряд. На POSIX - через writev (сборная запись без промежуточного буфера),
+// на Windows - последовательными WriteFile.
+inline bool write_chunks(const std::string& path, const std::vector<Chunk>& chunks) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool ok = true;
+    for (const Chunk& chunk : chunks) {
+        size_t offset = 0;
+        while (ok && offset < chunk.size) {
+            DWORD part = static_cast<DWORD>(std::min<size_t>(chunk.size - offset, 1u << 30));
+            DWORD written = 0;
+            ok = WriteFile(file, chunk.data + offset, part, &written, nullptr) && written > 0;
+            offset += written;
+        }
+    }
+    return CloseHandle(file) && ok;
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    std::vector<iovec> iov(chunks.size());
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        iov[i].iov_base = const_cast<unsigned char*>(chunks[i].data);
+        iov[i].iov_len = chunks[i].size;
+    }
+    // Число фрагментов в одном вызове ограничено IOV_MAX; writev может записать и не всё
+    long max_chunks = sysconf(_SC_IOV_MAX);
+    if (max_chunks <= 0) {
+        max_chunks = 16;
+    }
+    size_t first = 0;
+    while (first < iov.size()) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - first, static_cast<size_t>(max_chunks)));
+        ssize_t written = writev(fd, &iov[first], count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ::close(fd);
+            return false;
+        }
+        size_t left = static_cast<size_t>(written);
+        while (first < iov.size() && left >= iov[first].iov_len) {
+            left -= iov[first].iov_len;
+            ++first;
+        }
+        if (left > 0) {
+            iov[first].iov_base = static_cast<unsigned char*>(iov[first].iov_base) + left;
+            iov[first].iov_len -= left;
+        }
+    }
+    return ::close(fd) == 0;
+#endif
+}
+
+} // namespace pnm_detail
+
+// Разбор заголовка P5/P6; true, только если файл целиком содержит пиксельные данные
+inline bool parse_pnm_header(const unsigned char* data, size_t size, PnmHeader& header) {
+    if (size < 3 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) {
+        return false;
+    }
+    header.channels = data[1] == '5' ? 1 : 3;
+
+    size_t pos = 2;
+    if (!pnm_detail::read_number(data, size, pos, header.width) ||
+        !pnm_detail::read_number(data, size, pos, header.height) ||
+        !pnm_detail::read_number(data, size, pos, header.maxval)) {
+        return false;
+    }
+    // После maxval ровно один пробельный символ, дальше сразу данные
+    if (pos >= size || !pnm_detail::is_space(data[pos])) {
+        return false;
+    }
+    header.data_offset = pos + 1;
+
+    if (header.width <= 0 || header.height <= 0 || header.maxval <= 0 || header.maxval > 65535) {
+        return false;
+    }
+    const size_t sample_size = header.maxval > 255 ? 2 : 1;
+    const size_t data_size = static_cast<size_t>(header.width) * header.height * header.channels * sample_size;
+    return header.data_offset + data_size <= size;
+}
+
+// Путь с расширением .pgm или .pnm (без учёта регистра) - запись в бинарный PGM
+inline bool has_pgm_extension(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string extension = path.substr(dot + 1);
+    for (char& c : extension) {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    return extension == "pnm" || extension == "pgm";
+}
+
+// Запись бинарного PNM: P5 при channels == 1, P6 при channels == 3; stride - шаг строк в байтах.
+// Данные не сжимаются и не копируются: заголовок и строки уходят в файл одной сборной записью
+// (если строки идут подряд - одним фрагментом).
+inline bool write_pnm(const std::string& path, const unsigned char* data, int width, int height, int channels,
+    size_t stride) {
+    if ((channels != 1 && channels != 3) || width <= 0 || height <= 0) {
+        return false;
+    }
+    char header[64];
+    int header_size = std::snprintf(header, sizeof(header), "P%c\n%d %d\n255\n", channels == 1 ? '5' : '6', width, height);
+
+    const size_t row_size = static_cast<size_t>(width) * channels;
+    std::vector<pnm_detail::Chunk> chunks;
+    chunks.push_back({ reinterpret_cast<const unsigned char*>(header), static_cast<size_t>(header_size) });
+    if (stride == row_size) {
+        chunks.push_back({ data, row_size * height });
+    }
+    else {
+        for (int y = 0; y < height; ++y) {
+            chunks.push_back({ data + static_cast<size_t>(y) * stride, row_size });
+        }
+    }
+    return pnm_detail::write_chunks(path, chunks);
+}
@@ -0,0 +1,174 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Арена промежуточных буферов изображений. У каждого потока своя арена со списками свободных блоков
+// по классам размеров (четыре класса на каждую степень двойки, потери не больше 25%). Освобождённый блок
+// возвращается в арену потока, который его выделил, даже если освобождает другой поток (например,
+// буфер, записанный пулом кодирования), поэтому при пакетной обработке изображений одного размера
+// после первых изображений крупные блоки берутся только из арены.
+// Все блоки выровнены на kAlignment; блоки меньше kMinPooledSize выделяются напрямую.
+class ScratchArena {
+public:
+    static constexpr size_t kAlignment = 64;
+    static constexpr size_t kMinPooledSize = 64 * 1024;
+    static constexpr size_t kMaxCachedPerClass = 4;
+
+    ScratchArena() = default;
+    ~ScratchArena() {
+        for (auto& blocks : free_) {
+            for (void* block : blocks) {
+                free_block(block);
+            }
+        }
+    }
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    static void* allocate(size_t bytes) {
+        if (bytes < kMinPooledSize) {
+            void* block = new_block(bytes);
+            new (block) Header{ nullptr, kUnpooled, bytes };
+            return static_cast<char*>(block) + kHeaderSize;
+        }
+        size_t capacity;
+        const int size_class = class_of(bytes, capacity);
+        const std::shared_ptr<ScratchArena>& arena = local();
+        void* block = arena->take(size_class);
+        if (!block) {
+            block = new_block(capacity);
+            ++pooled_allocations_counter();
+        }
+        new (block) Header{ arena, size_class, capacity };
+        return static_cast<char*>(block) + kHeaderSize;
+    }
+
+    static void deallocate(void* pointer) {
+        if (!pointer) {
+            return;
+        }
+        void* block = static_cast<char*>(pointer) - kHeaderSize;
+        Header* header = static_cast<Header*>(block);
+        std::shared_ptr<ScratchArena> arena = std::move(header->arena);
+        const int size_class = header->size_class;
+        header->~Header();
+        if (arena) {
+            arena->put(size_class, block);
+        }
+        else {
+            free_block(block);
+        }
+    }
+
+    // realloc для буферов stb: содержимое сохраняется, пока хватает ёмкости блока - он не меняется
+    static void* reallocate(void* pointer, size_t bytes) {
+        if (!pointer) {
+            return allocate(bytes);
+        }
+        const size_t capacity = static_cast<Header*>(static_cast<void*>(static_cast<char*>(pointer) - kHeaderSize))->capacity;
+        if (bytes <= capacity) {
+            return pointer;
+        }
+        void* result = allocate(bytes);
+        std::memcpy(result, pointer, capacity);
+        deallocate(pointer);
+        return result;
+    }
+
+    // Число крупных блоков, запрошенных у системного аллокатора (для проверки переиспользования)
+    static size_t pooled_allocations() { return pooled_allocations_counter().load(); }
+
+private:
+    // Заголовок перед каждым блоком: арена-владелец (пусто для невыделенных из пула), класс и ёмкость
+    struct Header {
+        std::shared_ptr<ScratchArena> arena;
+        int size_class;
+        size_t capacity;
+    };
+    static constexpr size_t kHeaderSize = kAlignment;
+    static_assert(sizeof(Header) <= kHeaderSize, "заголовок блока должен помещаться в kHeaderSize");
+    static constexpr int kUnpooled = -1;
+    static constexpr int kClassesPerOctave = 4;
+    static constexpr int kClasses = 64 * kClassesPerOctave;
+
+    // Класс размера и его ёмкость: bytes округляется вверх до четверти своей степени двойки
+    static int class_of(size_t bytes, size_t& capacity) {
+        int octave = 0;
+        while ((bytes >> octave) > 1) {
+            ++octave;
+        }
+        const size_t step = size_t(1) << (octave - 2);
+        const size_t steps = (bytes + step - 1) / step; // от 4 до 8
+        capacity = steps * step;
+        return octave * kClassesPerOctave + static_cast<int>(steps) - kClassesPerOctave;
+    }
+
+    static const std::shared_ptr<ScratchArena>& local() {
+        thread_local std::shared_ptr<ScratchArena> arena = std::make_shared<ScratchArena>();
+        return arena;
+    }
+
+    static std::atomic<size_t>& pooled_allocations_counter() {
+        static std::atomic<size_t> counter{ 0 };
+        return counter;
+    }
+
+    static void* new_block(size_t bytes) {
+        return ::operator new(kHeaderSize + bytes, std::align_val_t(kAlignment));
+    }
+
+    static void free_block(void* block) {
+        ::operator delete(block, std::align_val_t(kAlignment));
+    }
+
+    void* take(int size_class) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<void*>& blocks = free_[size_class];
+        if (blocks.empty()) {
+            return nullptr;
+        }
+        void* block = blocks.back();
+        blocks.pop_back();
+        return block;
+    }
+
+    void put(int size_class, void* block) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<void*>& blocks = free_[size_class];
+            if (blocks.size() < kMaxCachedPerClass) {
+                blocks.push_back(block);
+                return;
+            }
+        }
+        free_block(block);
+    }
+
+    std::mutex mutex_;
+    std::vector<void*> free_[kClasses];
+};
+
+// Аллокатор контейнеров поверх ScratchArena
+template <typename T>
+struct ScratchAllocator {
+    using value_type = T;
+
+    ScratchAllocator() = default;
+    template <typename U> ScratchAllocator(const ScratchAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(ScratchArena::allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t) { ScratchArena::deallocate(p); }
+
+    template <typename U> bool operator==(const ScratchAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const ScratchAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
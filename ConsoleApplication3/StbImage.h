@@ -0,0 +1,100 @@
+﻿#pragma once
+
+// Реализация stb_image не защищена от повторного включения, поэтому заголовок подключается только если его ещё нет
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include "stb_image.h"
+#endif
+
+#include "MappedFile.h"
+#include "Pnm.h"
+
+#include <climits>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+// Изображение в буфере, выделенном stb_image. stbi_load возвращает пиксели подряд по kChannels байт,
+// поэтому буфер без копирования используется как массив Pixel и передаётся в stbi_write_* через bytes().
+// Буфер освобождается через stbi_image_free. Пиксели 8-битного PNM с тем же числом каналов берутся
+// прямо из отображения файла в память, которое тогда живёт вместе с изображением.
+template <typename Pixel>
+class StbImage {
+public:
+    static_assert(alignof(Pixel) == 1 && sizeof(Pixel) >= 1 && sizeof(Pixel) <= 4,
+        "Pixel должен состоять из 1-4 байтовых каналов без выравнивания");
+    static constexpr int kChannels = static_cast<int>(sizeof(Pixel));
+
+    StbImage() = default;
+
+    // Принятие во владение буфера stb_image из width * height пикселей (nullptr - пустое изображение)
+    StbImage(unsigned char* data, int width, int height)
+        : pixels_(reinterpret_cast<Pixel*>(data)), width_(data ? width : 0), height_(data ? height : 0) {}
+
+    // Загрузка файла с приведением к kChannels каналам; при ошибке изображение пустое.
+    // channels_in_file - число каналов в самом файле.
+    // Файл отображается в память и декодируется из неё; если отобразить не удалось, читается через stdio.
+    static StbImage load(const std::string& path, int* channels_in_file = nullptr) {
+        int width = 0, height = 0, channels = 0;
+        unsigned char* data = nullptr;
+
+        auto file = std::make_shared<MappedFile>(path);
+        if (file->is_open() && file->size() <= static_cast<size_t>(INT_MAX)) {
+            PnmHeader pnm;
+            if (parse_pnm_header(file->data(), file->size(), pnm) && pnm.maxval == 255 && pnm.channels == kChannels) {
+                if (channels_in_file) {
+                    *channels_in_file = pnm.channels;
+                }
+                unsigned char* pixels = file->data() + pnm.data_offset;
+                return StbImage(std::move(file), pixels, pnm.width, pnm.height);
+            }
+            data = stbi_load_from_memory(file->data(), static_cast<int>(file->size()), &width, &height, &channels, kChannels);
+        }
+        else {
+            data = stbi_load(path.c_str(), &width, &height, &channels, kChannels);
+        }
+        if (channels_in_file) {
+            *channels_in_file = channels;
+        }
+        return StbImage(data, width, height);
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t size() const { return static_cast<size_t>(width_) * height_; }
+    bool empty() const { return !pixels_; }
+
+    Pixel* data() { return pixels_.get(); }
+    const Pixel* data() const { return pixels_.get(); }
+    const unsigned char* bytes() const { return reinterpret_cast<const unsigned char*>(pixels_.get()); }
+
+    Pixel& operator[](size_t i) { return pixels_[i]; }
+    const Pixel& operator[](size_t i) const { return pixels_[i]; }
+
+    Pixel* row(int y) { return pixels_.get() + static_cast<size_t>(y) * width_; }
+    const Pixel* row(int y) const { return pixels_.get() + static_cast<size_t>(y) * width_; }
+
+    Pixel* begin() { return pixels_.get(); }
+    Pixel* end() { return pixels_.get() + size(); }
+    const Pixel* begin() const { return pixels_.get(); }
+    const Pixel* end() const { return pixels_.get() + size(); }
+
+private:
+    // Пиксели внутри отображения файла: освобождается само отображение
+    StbImage(std::shared_ptr<MappedFile> file, unsigned char* data, int width, int height)
+        : pixels_(reinterpret_cast<Pixel*>(data), Deleter{ std::move(file) }), width_(width), height_(height) {}
+
+    struct Deleter {
+        std::shared_ptr<MappedFile> file;
+
+        void operator()(Pixel* pixels) const {
+            if (!file) {
+                stbi_image_free(pixels);
+            }
+        }
+    };
+
+    std::unique_ptr<Pixel[], Deleter> pixels_;
+    int width_ = 0;
+    int height_ = 0;
+};
@@ -0,0 +1,171 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с отдельной очередью задач у каждого потока и перехватом работы (work stealing):
+// поток берёт задачи с конца своей очереди, а когда она пуста - с начала чужих очередей.
+class ThreadPool {
+public:
+    // threads == 0 - по числу аппаратных потоков
+    explicit ThreadPool(unsigned threads = 0) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+        for (unsigned i = 0; i < threads; ++i) {
+            workers_.emplace_back([this, i] { worker_loop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+    // Постановка задачи; очереди потоков заполняются по кругу
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++pending_;
+        }
+        Queue& queue = *queues_[next_queue_++ % queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        ++queued_;
+        {
+            // Захват мьютекса гарантирует, что поток, проверивший queued_ до инкремента, уже ждёт на wake_
+            std::lock_guard<std::mutex> lock(mutex_);
+        }
+        wake_.notify_one();
+    }
+
+    // Ожидание завершения всех поставленных задач
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+    }
+
+    // Выполнение body(i) для i из [0, count) с ожиданием завершения.
+    // Вызывающий поток тоже выполняет задачи, поэтому вызов допустим и изнутри задачи пула.
+    void parallel_for(int count, const std::function<void(int)>& body) {
+        if (count <= 0) {
+            return;
+        }
+        if (count == 1 || size() <= 1) {
+            for (int i = 0; i < count; ++i) {
+                body(i);
+            }
+            return;
+        }
+
+        struct Batch {
+            std::mutex mutex;
+            std::condition_variable done;
+            int remaining;
+        };
+        auto batch = std::make_shared<Batch>();
+        batch->remaining = count;
+        for (int i = 0; i < count; ++i) {
+            submit([batch, &body, i] {
+                body(i);
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                if (--batch->remaining == 0) {
+                    batch->done.notify_all();
+                }
+            });
+        }
+
+        std::function<void()> task;
+        while (try_pop(queues_.size(), task)) {
+            run(task);
+        }
+        std::unique_lock<std::mutex> lock(batch->mutex);
+        batch->done.wait(lock, [&] { return batch->remaining == 0; });
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Своя очередь - с конца (самые свежие задачи), чужие - с начала
+    bool try_pop(size_t own, std::function<void()>& task) {
+        for (size_t k = 0; k < queues_.size(); ++k) {
+            size_t index = (own + k) % queues_.size();
+            Queue& queue = *queues_[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (index == own) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            --queued_;
+            return true;
+        }
+        return false;
+    }
+
+    void run(std::function<void()>& task) {
+        task();
+        task = nullptr;
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--pending_ == 0) {
+            done_.notify_all();
+        }
+    }
+
+    void worker_loop(size_t index) {
+        std::function<void()> task;
+        for (;;) {
+            if (try_pop(index, task)) {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stop_ || queued_ > 0; });
+            if (stop_ && queued_ == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::atomic<size_t> queued_{ 0 };
+    std::atomic<size_t> next_queue_{ 0 };
+    size_t pending_ = 0;
+    bool stop_ = false;
+};